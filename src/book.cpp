@@ -8,31 +8,40 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <sys/mman.h>
+
 #include "board.h"
 #include "book.h"
+#include "book_compress.h"
+#include "book_index.h"
 #include "move.h"
 #include "move_legal.h"
 #include "san.h"
 #include "util.h"
 
+// constants
+
+static const int CheckNb = 64; // keys looked up both ways when an index or a compressed book is opened
+
 // types
 
-struct entry_t {
-   uint64 key;
-   uint16 move;
-   uint16 count;
-   uint16 n;
-   uint16 sum;
-};
+typedef book_entry_t entry_t; // see book.h
 
 // variables
 
 static FILE * BookFile;
+static bool BookReadOnly; // no learning
 static int BookSize;
+static uint8 * BookData; // the mapped file, NULL if it is read through BookFile
+static bix_t BookIndex[1]; // book-index sidecar, data is NULL without one
+static cbook_t BookCompressed[1]; // book-compress format, data is NULL for a .bin
 
 // prototypes
 
 static int    find_pos      (uint64 key);
+static int    probe_compare (const void * p1, const void * p2);
+static int    search_pos    (uint64 key);
+static bool   index_check   (uint64 last_key);
 
 static void   read_entry    (entry_t * entry, int n);
 static void   write_entry   (const entry_t * entry, int n);
@@ -40,6 +49,9 @@ static void   write_entry   (const entry_t * entry, int n);
 static uint64 read_integer  (FILE * file, int size);
 static void   write_integer (FILE * file, int size, uint64 n);
 
+static uint64 get_integer   (const uint8 data[], int size);
+static void   put_integer   (uint8 data[], int size, uint64 n);
+
 // functions
 
 // book_clear()
@@ -47,30 +59,85 @@ static void   write_integer (FILE * file, int size, uint64 n);
 void book_clear() {
 
    BookFile = NULL;
+   BookReadOnly = false;
    BookSize = 0;
+   BookData = NULL;
+   BookIndex->data = NULL;
+   BookCompressed->data = NULL;
 }
 
 // book_open()
 
 void book_open(const char file_name[]) {
 
+   entry_t first[1], last[1];
+
    ASSERT(file_name!=NULL);
 
+   // a book we can't write to is still good for probing
+
    BookFile = fopen(file_name,"rb+");
+   BookReadOnly = false;
+
+   if (BookFile == NULL && (errno == EACCES || errno == EROFS)) {
+      BookFile = fopen(file_name,"rb");
+      BookReadOnly = true;
+   }
+
    if (BookFile == NULL) my_fatal("book_open(): can't open file \"%s\": %s\n",file_name,strerror(errno));
 
+   // a compressed book decodes one block per probe, it has its own key index
+
+   if (cbook_open(BookCompressed,BookFile,file_name)) {
+      BookReadOnly = true;
+      BookSize = BookCompressed->entry_nb;
+      read_entry(last,BookSize-1);
+      if (!index_check(last->key)) my_fatal("book_open(): \"%s\" is damaged, its block index doesn't match the entries\n",file_name);
+      return;
+   }
+
    if (fseek(BookFile,0,SEEK_END) == -1) {
       my_fatal("book_open(): fseek(): %s\n",strerror(errno));
    }
 
    BookSize = ftell(BookFile) / 16;
    if (BookSize == 0) my_fatal("book_open(): empty file\n");
+
+   // probes decode the entries in place, stdio is only a fallback
+
+   BookData = (uint8 *) mmap(NULL,size_t(BookSize)*16,BookReadOnly?PROT_READ:PROT_READ|PROT_WRITE,MAP_SHARED,fileno(BookFile),0);
+
+   if (BookData == MAP_FAILED) {
+      my_log("POLYGLOT book_open(): mmap(): %s, reading \"%s\" with stdio\n",strerror(errno),file_name);
+      BookData = NULL;
+   } else {
+      madvise(BookData,size_t(BookSize)*16,MADV_RANDOM); // a binary search, read-ahead is wasted
+   }
+
+   // the optional index built by book-index
+
+   read_entry(first,0);
+   read_entry(last,BookSize-1);
+
+   if (bix_open(BookIndex,file_name,BookSize,first->key,last->key) && !index_check(last->key)) {
+      my_log("POLYGLOT ignoring the index of \"%s\", it doesn't match the book\n",file_name);
+      bix_close(BookIndex);
+   }
 }
 
 // book_close()
 
 void book_close() {
 
+   if (BookIndex->data != NULL) bix_close(BookIndex);
+   if (BookCompressed->data != NULL) cbook_close(BookCompressed);
+
+   if (BookData != NULL && munmap(BookData,size_t(BookSize)*16) == -1) {
+      my_fatal("book_close(): munmap(): %s\n",strerror(errno));
+   }
+
+   BookData = NULL;
+
    if (fclose(BookFile) == EOF) {
       my_fatal("book_close(): fclose(): %s\n",strerror(errno));
    }
@@ -190,6 +257,98 @@ void book_disp(const board_t * board) {
    printf("\n");
 }
 
+// book_find_keys()
+
+void book_find_keys(book_probe_t probe[], int probe_nb) {
+
+   int i;
+   int pos, end, mid;
+   int step;
+   entry_t entry[1];
+
+   ASSERT(probe!=NULL);
+   ASSERT(probe_nb>=0);
+
+   // sort the keys, then answer them in one pass over the book, front to back
+
+   qsort(probe,probe_nb,sizeof(book_probe_t),&probe_compare);
+
+   if (BookData != NULL) madvise(BookData,size_t(BookSize)*16,MADV_NORMAL); // read-ahead
+
+   pos = 0; // the entries before pos are smaller than the current key
+
+   for (i = 0; i < probe_nb; i++) {
+
+      if (i > 0 && probe[i].key == probe[i-1].key) {
+         probe[i].pos = probe[i-1].pos;
+         probe[i].size = probe[i-1].size;
+         continue;
+      }
+
+      if (BookCompressed->data != NULL) {
+
+         // the sorted keys walk the blocks forward, each one is decoded once
+
+         pos = cbook_find(BookCompressed,probe[i].key);
+
+      } else {
+
+         // gallop forward, so that sparse keys don't read the whole book
+
+         end = pos;
+         step = 1;
+
+         while (end < BookSize) {
+
+            read_entry(entry,end);
+            if (entry->key >= probe[i].key) break;
+
+            pos = end + 1;
+            end = pos + step;
+            step *= 2;
+         }
+
+         if (end > BookSize) end = BookSize;
+
+         // binary search between the last two steps (finds the leftmost entry)
+
+         while (pos < end) {
+
+            mid = pos + (end - pos) / 2;
+            read_entry(entry,mid);
+
+            if (entry->key < probe[i].key) {
+               pos = mid + 1;
+            } else {
+               end = mid;
+            }
+         }
+      }
+
+      probe[i].size = 0;
+
+      for (end = pos; end < BookSize; end++) {
+         read_entry(entry,end);
+         if (entry->key != probe[i].key) break;
+         probe[i].size++;
+      }
+
+      probe[i].pos = (probe[i].size != 0) ? pos : -1;
+   }
+
+   if (BookData != NULL) madvise(BookData,size_t(BookSize)*16,MADV_RANDOM);
+}
+
+// book_read_entry()
+
+void book_read_entry(book_entry_t * entry, int pos) {
+
+   ASSERT(entry!=NULL);
+   ASSERT(pos>=0&&pos<BookSize);
+
+   read_entry(entry,pos);
+}
+
 // book_learn_move()
 
 void book_learn_move(const board_t * board, int move, int result) {
@@ -224,6 +383,12 @@ void book_learn_move(const board_t * board, int move, int result) {
 
 void book_flush() {
 
+   // learnt entries are written straight into the mapping
+
+   if (BookData != NULL && msync(BookData,size_t(BookSize)*16,MS_ASYNC) == -1) {
+      my_fatal("book_flush(): msync(): %s\n",strerror(errno));
+   }
+
    if (fflush(BookFile) == EOF) {
       my_fatal("book_flush(): fflush(): %s\n",strerror(errno));
    }
@@ -233,6 +398,43 @@ void book_flush() {
 
 static int find_pos(uint64 key) {
 
+   int pos;
+   entry_t entry[1];
+
+   if (BookCompressed->data != NULL) {
+      pos = cbook_find(BookCompressed,key);
+      if (pos >= BookSize) return BookSize;
+      read_entry(entry,pos);
+      return (entry->key == key) ? pos : BookSize;
+   }
+
+   if (BookIndex->data == NULL) return search_pos(key);
+
+   if (BookIndex->kind == BixHash) {
+
+      // one read tells the key from another one sharing its slot
+
+      pos = bix_find(BookIndex,key);
+      if (pos < 0 || pos >= BookSize) return BookSize;
+
+      read_entry(entry,pos);
+      return (entry->key == key) ? pos : BookSize;
+   }
+
+   // the index points at most one block before the leftmost entry
+
+   for (pos = bix_find(BookIndex,key); pos < BookSize; pos++) {
+      read_entry(entry,pos);
+      if (entry->key >= key) return (entry->key == key) ? pos : BookSize;
+   }
+
+   return BookSize;
+}
+
+// search_pos()
+
+static int search_pos(uint64 key) {
+
    int left, right, mid;
    entry_t entry[1];
 
@@ -264,14 +466,82 @@ static int find_pos(uint64 key) {
    return (entry->key == key) ? left : BookSize;
 }
 
+// index_check()
+
+static bool index_check(uint64 last_key) {
+
+   int step;
+   int pos;
+   entry_t entry[1];
+
+   ASSERT(BookIndex->data!=NULL||BookCompressed->data!=NULL);
+
+   // a few keys spread over the book, the header only covers the ends
+
+   step = BookSize / CheckNb + 1;
+
+   for (pos = 0; pos < BookSize; pos += step) {
+      read_entry(entry,pos);
+      if (find_pos(entry->key) != search_pos(entry->key)) return false;
+   }
+
+   // keys outside the book, a partial last block or index level must miss cleanly
+
+   if (find_pos(0) != search_pos(0)) return false;
+   if (last_key != ~uint64(0) && find_pos(last_key+1) != BookSize) return false;
+   if (find_pos(~uint64(0)) != search_pos(~uint64(0))) return false;
+
+   return true;
+}
+
+// probe_compare()
+
+static int probe_compare(const void * p1, const void * p2) {
+
+   const book_probe_t * probe_1, * probe_2;
+
+   ASSERT(p1!=NULL);
+   ASSERT(p2!=NULL);
+
+   probe_1 = (const book_probe_t *) p1;
+   probe_2 = (const book_probe_t *) p2;
+
+   // key order, ties in the caller's order
+
+   if (probe_1->key < probe_2->key) return -1;
+   if (probe_1->key > probe_2->key) return +1;
+
+   return (probe_1->index > probe_2->index) - (probe_1->index < probe_2->index);
+}
+
 // read_entry()
 
 static void read_entry(entry_t * entry, int n) {
 
+   const uint8 * data;
+
    ASSERT(entry!=NULL);
    ASSERT(n>=0&&n<BookSize);
 
-   if (fseek(BookFile,n*16,SEEK_SET) == -1) {
+   if (BookCompressed->data != NULL) {
+      cbook_read(BookCompressed,entry,n);
+      return;
+   }
+
+   if (BookData != NULL) {
+
+      data = &BookData[size_t(n)*16];
+
+      entry->key   = get_integer(&data[0],8);
+      entry->move  = get_integer(&data[8],2);
+      entry->count = get_integer(&data[10],2);
+      entry->n     = get_integer(&data[12],2);
+      entry->sum   = get_integer(&data[14],2);
+
+      return;
+   }
+
+   if (fseek(BookFile,long(n)*16,SEEK_SET) == -1) {
       my_fatal("read_entry(): fseek(): %s\n",strerror(errno));
    }
 
@@ -286,10 +556,28 @@ static void read_entry(entry_t * entry, int n) {
 
 static void write_entry(const entry_t * entry, int n) {
 
+   uint8 * data;
+
    ASSERT(entry!=NULL);
    ASSERT(n>=0&&n<BookSize);
 
-   if (fseek(BookFile,n*16,SEEK_SET) == -1) {
+   if (BookCompressed->data != NULL) my_fatal("write_entry(): a compressed book can't be written to, learning needs a .bin\n");
+   if (BookReadOnly) my_fatal("write_entry(): the book can't be written to, learning needs write access\n");
+
+   if (BookData != NULL) {
+
+      data = &BookData[size_t(n)*16];
+
+      put_integer(&data[0],8,entry->key);
+      put_integer(&data[8],2,entry->move);
+      put_integer(&data[10],2,entry->count);
+      put_integer(&data[12],2,entry->n);
+      put_integer(&data[14],2,entry->sum);
+
+      return;
+   }
+
+   if (fseek(BookFile,long(n)*16,SEEK_SET) == -1) {
       my_fatal("write_entry(): fseek(): %s\n",strerror(errno));
    }
 
@@ -354,5 +642,42 @@ static void write_integer(FILE * file, int size, uint64 n) {
    }
 }
 
+// get_integer()
+
+static uint64 get_integer(const uint8 data[], int size) {
+
+   uint64 n;
+   int i;
+
+   ASSERT(data!=NULL);
+   ASSERT(size>0&&size<=8);
+
+   // big-endian, like read_integer()
+
+   n = 0;
+
+   for (i = 0; i < size; i++) {
+      n = (n << 8) | data[i];
+   }
+
+   return n;
+}
+
+// put_integer()
+
+static void put_integer(uint8 data[], int size, uint64 n) {
+
+   int i;
+
+   ASSERT(data!=NULL);
+   ASSERT(size>0&&size<=8);
+   ASSERT(size==8||n>>(size*8)==0);
+
+   for (i = size-1; i >= 0; i--) {
+      data[i] = uint8(n & 0xFF);
+      n >>= 8;
+   }
+}
+
 // end of book.cpp
 
@@ -9,6 +9,23 @@
 #include "board.h"
 #include "util.h"
 
+// types
+
+struct book_entry_t {
+   uint64 key;
+   uint16 move;
+   uint16 count; // weight
+   uint16 n; // learning
+   uint16 sum;
+};
+
+struct book_probe_t {
+   uint64 key;
+   int index; // set by the caller, kept through the sort
+   int pos; // first entry of key, -1 if it is not in the book
+   int size; // entries of key
+};
+
 // functions
 
 extern void book_clear      ();
@@ -20,6 +37,9 @@ extern bool is_in_book      (const board_t * board);
 extern int  book_move       (const board_t * board, bool random);
 extern void book_disp       (const board_t * board);
 
+extern void book_find_keys  (book_probe_t probe[], int probe_nb);
+extern void book_read_entry (book_entry_t * entry, int pos);
+
 extern void book_learn_move (const board_t * board, int move, int result);
 extern void book_flush      ();
 
@@ -0,0 +1,665 @@
+
+// book_compress.cpp
+
+// includes
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/mman.h>
+
+#include "book.h"
+#include "book_compress.h"
+#include "util.h"
+
+// constants
+
+static const uint32 CbookMagic = 0x50474243; // "PGBC"
+static const int CbookVersion = 1;
+
+static const int CbookHeaderSize = 64;
+static const int CbookIndexSize = 16; // first key, offset of the block
+
+static const int BlockSize = 16; // default, about 150 bytes to decode per probe
+static const int BlockSizeMax = 4096;
+
+static const int EntrySizeMax = 10 + 3 + 3 * 3; // key delta, move and flag, count, n and sum
+
+static const int BufferSize = 1 << 20;
+
+// prototypes
+
+static void   cbook_build   (const char bin_file_name[], const char file_name[], int block_size);
+
+static void   block_decode  (cbook_t * cbook, int block);
+static uint64 block_key     (const cbook_t * cbook, int block);
+static size_t block_offset  (const cbook_t * cbook, int block);
+
+static int    put_varint    (uint8 data[], uint64 n);
+static uint64 get_varint    (const uint8 * * data, const uint8 * end);
+
+static uint64 get_integer   (const uint8 data[], int size);
+static void   put_integer   (uint8 data[], int size, uint64 n);
+static void   write_integer (FILE * file, int size, uint64 n);
+
+// functions
+
+// book_compress()
+
+void book_compress(int argc, char * argv[]) {
+
+   int i;
+   const char * bin_file;
+   const char * out_file;
+   int block_size;
+
+   bin_file = NULL;
+   my_string_set(&bin_file,"book.bin");
+
+   out_file = NULL;
+   my_string_set(&out_file,"book.pbc");
+
+   block_size = BlockSize;
+
+   for (i = 1; i < argc; i++) {
+
+      if (false) {
+
+      } else if (my_string_equal(argv[i],"book-compress")) {
+
+         // skip
+
+      } else if (my_string_equal(argv[i],"-bin")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_compress(): missing argument\n");
+
+         my_string_set(&bin_file,argv[i]);
+
+      } else if (my_string_equal(argv[i],"-out")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_compress(): missing argument\n");
+
+         my_string_set(&out_file,argv[i]);
+
+      } else if (my_string_equal(argv[i],"-block")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_compress(): missing argument\n");
+
+         block_size = atoi(argv[i]);
+         if (block_size < 1 || block_size > BlockSizeMax) my_fatal("book_compress(): -block must be between 1 and %d\n",BlockSizeMax);
+
+      } else {
+
+         my_fatal("book_compress(): unknown option \"%s\"\n",argv[i]);
+      }
+   }
+
+   cbook_build(bin_file,out_file,block_size);
+}
+
+// book_expand()
+
+void book_expand(int argc, char * argv[]) {
+
+   int i;
+   const char * in_file;
+   const char * bin_file;
+   char tmp_name[4096+4];
+   FILE * in, * out;
+   cbook_t cbook[1];
+   book_entry_t entry[1];
+   int pos;
+
+   in_file = NULL;
+   my_string_set(&in_file,"book.pbc");
+
+   bin_file = NULL;
+   my_string_set(&bin_file,"book.bin");
+
+   for (i = 1; i < argc; i++) {
+
+      if (false) {
+
+      } else if (my_string_equal(argv[i],"book-expand")) {
+
+         // skip
+
+      } else if (my_string_equal(argv[i],"-in")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_expand(): missing argument\n");
+
+         my_string_set(&in_file,argv[i]);
+
+      } else if (my_string_equal(argv[i],"-bin")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_expand(): missing argument\n");
+
+         my_string_set(&bin_file,argv[i]);
+
+      } else {
+
+         my_fatal("book_expand(): unknown option \"%s\"\n",argv[i]);
+      }
+   }
+
+   in = fopen(in_file,"rb");
+   if (in == NULL) my_fatal("book_expand(): can't open file \"%s\": %s\n",in_file,strerror(errno));
+
+   if (!cbook_open(cbook,in,in_file)) my_fatal("book_expand(): \"%s\" is not a compressed book\n",in_file);
+
+   // write a temporary file and rename it, book_open() may be reading the old one
+
+   sprintf(tmp_name,"%.4000s.tmp",bin_file);
+
+   out = fopen(tmp_name,"wb");
+   if (out == NULL) my_fatal("book_expand(): can't open file \"%s\": %s\n",tmp_name,strerror(errno));
+
+   setvbuf(out,NULL,_IOFBF,BufferSize);
+
+   for (pos = 0; pos < cbook->entry_nb; pos++) {
+
+      cbook_read(cbook,entry,pos);
+
+      write_integer(out,8,entry->key);
+      write_integer(out,2,entry->move);
+      write_integer(out,2,entry->count);
+      write_integer(out,2,entry->n);
+      write_integer(out,2,entry->sum);
+   }
+
+   if (fclose(out) == EOF) my_fatal("book_expand(): fclose(): %s\n",strerror(errno));
+
+   if (rename(tmp_name,bin_file) != 0) {
+      my_fatal("book_expand(): can't rename \"%s\" to \"%s\": %s\n",tmp_name,bin_file,strerror(errno));
+   }
+
+   printf("%d entr%s written to \"%s\".\n",cbook->entry_nb,(cbook->entry_nb>1)?"ies":"y",bin_file);
+
+   cbook_close(cbook);
+   fclose(in);
+}
+
+// cbook_open()
+
+bool cbook_open(cbook_t * cbook, FILE * file, const char file_name[]) {
+
+   uint8 header[CbookHeaderSize];
+   long int size;
+   uint64 entry_nb, index_offset;
+   void * data;
+
+   ASSERT(cbook!=NULL);
+   ASSERT(file!=NULL);
+   ASSERT(file_name!=NULL);
+
+   // returns false if the file is not a compressed book, book_open() then reads it as a .bin
+
+   cbook->data = NULL;
+   cbook->size = 0;
+   cbook->entry_nb = 0;
+   cbook->block_size = 0;
+   cbook->block_nb = 0;
+   cbook->index = NULL;
+   cbook->block = -1;
+   cbook->entry = NULL;
+
+   if (fseek(file,0,SEEK_END) == -1) my_fatal("cbook_open(): fseek(): %s\n",strerror(errno));
+   size = ftell(file);
+   rewind(file);
+
+   if (size < CbookHeaderSize) return false;
+
+   if (fread(header,1,CbookHeaderSize,file) != size_t(CbookHeaderSize)) {
+      my_fatal("cbook_open(): fread(): %s\n",strerror(errno));
+   }
+
+   if (get_integer(&header[0],4) != CbookMagic) return false;
+
+   if (get_integer(&header[4],4) != uint64(CbookVersion)) {
+      my_fatal("cbook_open(): \"%s\" was compressed by another version\n",file_name);
+   }
+
+   entry_nb = get_integer(&header[8],8);
+   cbook->block_size = int(get_integer(&header[16],4));
+   cbook->block_nb = int(get_integer(&header[20],4));
+   index_offset = get_integer(&header[40],8);
+
+   if (entry_nb == 0 || entry_nb > 0x7FFFFFFF
+    || cbook->block_size <= 0 || cbook->block_size > BlockSizeMax
+    || uint64(cbook->block_nb) != (entry_nb + cbook->block_size - 1) / cbook->block_size
+    || index_offset < uint64(CbookHeaderSize)
+    || uint64(size) != index_offset + uint64(cbook->block_nb) * CbookIndexSize) {
+      my_fatal("cbook_open(): \"%s\" is damaged\n",file_name);
+   }
+
+   cbook->entry_nb = int(entry_nb);
+
+   // the whole file is mapped, blocks are decoded on demand
+
+   data = mmap(NULL,size_t(size),PROT_READ,MAP_SHARED,fileno(file),0);
+   if (data == MAP_FAILED) my_fatal("cbook_open(): mmap(): %s\n",strerror(errno));
+
+   madvise(data,size_t(size),MADV_RANDOM);
+
+   cbook->data = (const uint8 *) data;
+   cbook->size = size_t(size);
+   cbook->index = &cbook->data[index_offset];
+
+   cbook->entry = (book_entry_t *) my_malloc(cbook->block_size*sizeof(book_entry_t));
+
+   return true;
+}
+
+// cbook_close()
+
+void cbook_close(cbook_t * cbook) {
+
+   ASSERT(cbook!=NULL);
+
+   if (cbook->data != NULL && munmap((void *) cbook->data,cbook->size) == -1) {
+      my_fatal("cbook_close(): munmap(): %s\n",strerror(errno));
+   }
+
+   if (cbook->entry != NULL) my_free(cbook->entry);
+
+   cbook->data = NULL;
+   cbook->size = 0;
+   cbook->entry_nb = 0;
+   cbook->block_size = 0;
+   cbook->block_nb = 0;
+   cbook->index = NULL;
+   cbook->block = -1;
+   cbook->entry = NULL;
+}
+
+// cbook_find()
+
+int cbook_find(cbook_t * cbook, uint64 key) {
+
+   int left, right, mid;
+   int block, size;
+   int i;
+
+   ASSERT(cbook!=NULL);
+   ASSERT(cbook->data!=NULL);
+
+   // first block whose first key is not smaller (binary search over the index)
+
+   left = 0;
+   right = cbook->block_nb;
+
+   while (left < right) {
+
+      mid = (left + right) / 2;
+
+      if (block_key(cbook,mid) < key) {
+         left = mid+1;
+      } else {
+         right = mid;
+      }
+   }
+
+   if (left == 0) return 0;
+
+   // the key can start in the block before, the only one that is decoded
+
+   block = left - 1;
+   block_decode(cbook,block);
+
+   size = cbook->entry_nb - block * cbook->block_size;
+   if (size > cbook->block_size) size = cbook->block_size;
+
+   for (i = 0; i < size; i++) {
+      if (cbook->entry[i].key >= key) return block * cbook->block_size + i;
+   }
+
+   // past the end of the block, the last block can be shorter than the others
+
+   if (left == cbook->block_nb) return cbook->entry_nb;
+
+   return left * cbook->block_size;
+}
+
+// cbook_read()
+
+void cbook_read(cbook_t * cbook, book_entry_t * entry, int pos) {
+
+   int block;
+
+   ASSERT(cbook!=NULL);
+   ASSERT(cbook->data!=NULL);
+   ASSERT(entry!=NULL);
+   ASSERT(pos>=0&&pos<cbook->entry_nb);
+
+   block = pos / cbook->block_size;
+   if (block != cbook->block) block_decode(cbook,block);
+
+   *entry = cbook->entry[pos%cbook->block_size];
+}
+
+// cbook_build()
+
+static void cbook_build(const char bin_file_name[], const char file_name[], int block_size) {
+
+   char tmp_name[4096+4];
+   FILE * bin_file;
+   FILE * file;
+   uint8 * buffer;
+   uint8 * index;
+   uint8 * block;
+   uint8 header[CbookHeaderSize];
+   int entry_nb, block_nb;
+   int pos, size, i;
+   const uint8 * data;
+   uint64 key, first_key, last_key;
+   uint64 offset;
+   int len;
+   int move, n, sum;
+
+   ASSERT(bin_file_name!=NULL);
+   ASSERT(file_name!=NULL);
+   ASSERT(block_size>=1&&block_size<=BlockSizeMax);
+
+   bin_file = fopen(bin_file_name,"rb");
+   if (bin_file == NULL) my_fatal("cbook_build(): can't open file \"%s\": %s\n",bin_file_name,strerror(errno));
+
+   if (fseek(bin_file,0,SEEK_END) == -1) my_fatal("cbook_build(): fseek(): %s\n",strerror(errno));
+   entry_nb = ftell(bin_file) / 16;
+   if (entry_nb == 0) my_fatal("cbook_build(): empty file\n");
+   rewind(bin_file);
+
+   block_nb = (entry_nb + block_size - 1) / block_size;
+
+   // write a temporary file and rename it, book_open() may be reading the old one
+
+   sprintf(tmp_name,"%.4000s.tmp",file_name);
+
+   file = fopen(tmp_name,"wb");
+   if (file == NULL) my_fatal("cbook_build(): can't open file \"%s\": %s\n",tmp_name,strerror(errno));
+
+   setvbuf(file,NULL,_IOFBF,BufferSize);
+
+   memset(header,0,CbookHeaderSize);
+   if (fwrite(header,1,CbookHeaderSize,file) != size_t(CbookHeaderSize)) my_fatal("cbook_build(): fwrite(): %s\n",strerror(errno));
+
+   // each block starts with a full key kept in the index, the other keys
+   // are varint deltas to the previous one, 0 between moves of a position;
+   // the move carries a flag for learning data, which most books don't have
+
+   buffer = (uint8 *) my_malloc(BufferSize);
+   index = (uint8 *) my_malloc(block_nb*CbookIndexSize);
+   block = (uint8 *) my_malloc(block_size*EntrySizeMax);
+
+   printf("compressing %d entries ...\n",entry_nb);
+
+   first_key = 0;
+   last_key = 0;
+   offset = CbookHeaderSize;
+   len = 0;
+
+   for (pos = 0; pos < entry_nb; pos += size) {
+
+      size = entry_nb - pos;
+      if (size > BufferSize / 16) size = BufferSize / 16;
+
+      if (fread(buffer,16,size,bin_file) != size_t(size)) my_fatal("cbook_build(): fread(): %s\n",strerror(errno));
+
+      for (i = 0; i < size; i++) {
+
+         data = &buffer[i*16];
+         key = get_integer(&data[0],8);
+
+         if (pos + i == 0) first_key = key;
+         if (key < last_key) my_fatal("cbook_build(): \"%s\" is not sorted by key\n",bin_file_name);
+
+         if ((pos + i) % block_size == 0) {
+
+            if (len != 0) {
+               if (fwrite(block,1,len,file) != size_t(len)) my_fatal("cbook_build(): fwrite(): %s\n",strerror(errno));
+               offset += len;
+               len = 0;
+            }
+
+            put_integer(&index[((pos+i)/block_size)*CbookIndexSize],8,key);
+            put_integer(&index[((pos+i)/block_size)*CbookIndexSize+8],8,offset);
+
+         } else {
+
+            len += put_varint(&block[len],key-last_key);
+         }
+
+         move = int(get_integer(&data[8],2));
+         n = int(get_integer(&data[12],2));
+         sum = int(get_integer(&data[14],2));
+
+         len += put_varint(&block[len],(uint64(move)<<1)|((n!=0||sum!=0)?1:0));
+         len += put_varint(&block[len],get_integer(&data[10],2)); // count
+
+         if (n != 0 || sum != 0) {
+            len += put_varint(&block[len],n);
+            len += put_varint(&block[len],sum);
+         }
+
+         ASSERT(len<=block_size*EntrySizeMax);
+
+         last_key = key;
+      }
+   }
+
+   if (fwrite(block,1,len,file) != size_t(len)) my_fatal("cbook_build(): fwrite(): %s\n",strerror(errno));
+   offset += len;
+
+   fclose(bin_file);
+
+   if (fwrite(index,CbookIndexSize,block_nb,file) != size_t(block_nb)) my_fatal("cbook_build(): fwrite(): %s\n",strerror(errno));
+
+   // the header goes last, once the index offset is known
+
+   put_integer(&header[0],4,CbookMagic);
+   put_integer(&header[4],4,CbookVersion);
+   put_integer(&header[8],8,entry_nb);
+   put_integer(&header[16],4,block_size);
+   put_integer(&header[20],4,block_nb);
+   put_integer(&header[24],8,first_key);
+   put_integer(&header[32],8,last_key);
+   put_integer(&header[40],8,offset);
+
+   if (fseek(file,0,SEEK_SET) == -1) my_fatal("cbook_build(): fseek(): %s\n",strerror(errno));
+   if (fwrite(header,1,CbookHeaderSize,file) != size_t(CbookHeaderSize)) my_fatal("cbook_build(): fwrite(): %s\n",strerror(errno));
+
+   if (fclose(file) == EOF) my_fatal("cbook_build(): fclose(): %s\n",strerror(errno));
+
+   if (rename(tmp_name,file_name) != 0) {
+      my_fatal("cbook_build(): can't rename \"%s\" to \"%s\": %s\n",tmp_name,file_name,strerror(errno));
+   }
+
+   my_free(buffer);
+   my_free(index);
+   my_free(block);
+
+   offset += uint64(block_nb) * CbookIndexSize;
+
+   printf("%d entr%s in %d block%s, %.1f bytes per entry, written to \"%s\".\n",
+          entry_nb,(entry_nb>1)?"ies":"y",block_nb,(block_nb>1)?"s":"",double(offset)/double(entry_nb),file_name);
+}
+
+// block_decode()
+
+static void block_decode(cbook_t * cbook, int block) {
+
+   const uint8 * data;
+   const uint8 * end;
+   book_entry_t * entry;
+   uint64 key;
+   uint64 move;
+   int size, i;
+
+   ASSERT(cbook!=NULL);
+   ASSERT(block>=0&&block<cbook->block_nb);
+
+   data = &cbook->data[block_offset(cbook,block)];
+   end = (block+1 < cbook->block_nb) ? &cbook->data[block_offset(cbook,block+1)] : cbook->index;
+
+   if (data < &cbook->data[CbookHeaderSize] || data > end || end > cbook->index) {
+      my_fatal("block_decode(): block %d is damaged\n",block);
+   }
+
+   size = cbook->entry_nb - block * cbook->block_size;
+   if (size > cbook->block_size) size = cbook->block_size;
+
+   key = block_key(cbook,block);
+
+   for (i = 0; i < size; i++) {
+
+      entry = &cbook->entry[i];
+
+      if (i > 0) key += get_varint(&data,end);
+
+      move = get_varint(&data,end);
+
+      entry->key = key;
+      entry->move = uint16(move >> 1);
+      entry->count = uint16(get_varint(&data,end));
+
+      if ((move & 1) != 0) {
+         entry->n = uint16(get_varint(&data,end));
+         entry->sum = uint16(get_varint(&data,end));
+      } else {
+         entry->n = 0;
+         entry->sum = 0;
+      }
+   }
+
+   cbook->block = block;
+}
+
+// block_key()
+
+static uint64 block_key(const cbook_t * cbook, int block) {
+
+   ASSERT(cbook!=NULL);
+   ASSERT(block>=0&&block<cbook->block_nb);
+
+   return get_integer(&cbook->index[size_t(block)*CbookIndexSize],8);
+}
+
+// block_offset()
+
+static size_t block_offset(const cbook_t * cbook, int block) {
+
+   ASSERT(cbook!=NULL);
+   ASSERT(block>=0&&block<cbook->block_nb);
+
+   return size_t(get_integer(&cbook->index[size_t(block)*CbookIndexSize+8],8));
+}
+
+// put_varint()
+
+static int put_varint(uint8 data[], uint64 n) {
+
+   int len;
+
+   ASSERT(data!=NULL);
+
+   // 7 bits per byte, low bits first, like the binary leveldb index
+
+   len = 0;
+
+   while (n >= 0x80) {
+      data[len++] = uint8((n & 0x7F) | 0x80);
+      n >>= 7;
+   }
+
+   data[len++] = uint8(n);
+
+   return len;
+}
+
+// get_varint()
+
+static uint64 get_varint(const uint8 * * data, const uint8 * end) {
+
+   uint64 n;
+   int shift;
+   int b;
+
+   ASSERT(data!=NULL);
+   ASSERT(*data!=NULL);
+   ASSERT(end!=NULL);
+
+   n = 0;
+   shift = 0;
+
+   do {
+      if (*data >= end || shift > 63) my_fatal("get_varint(): damaged block\n");
+      b = *(*data)++;
+      n |= uint64(b & 0x7F) << shift;
+      shift += 7;
+   } while ((b & 0x80) != 0);
+
+   return n;
+}
+
+// get_integer()
+
+static uint64 get_integer(const uint8 data[], int size) {
+
+   uint64 n;
+   int i;
+
+   ASSERT(data!=NULL);
+   ASSERT(size>0&&size<=8);
+
+   // big-endian, like every polyglot file
+
+   n = 0;
+
+   for (i = 0; i < size; i++) {
+      n = (n << 8) | data[i];
+   }
+
+   return n;
+}
+
+// put_integer()
+
+static void put_integer(uint8 data[], int size, uint64 n) {
+
+   int i;
+
+   ASSERT(data!=NULL);
+   ASSERT(size>0&&size<=8);
+   ASSERT(size==8||n>>(size*8)==0);
+
+   for (i = size-1; i >= 0; i--) {
+      data[i] = uint8(n & 0xFF);
+      n >>= 8;
+   }
+}
+
+// write_integer()
+
+static void write_integer(FILE * file, int size, uint64 n) {
+
+   int i;
+   int b;
+
+   ASSERT(file!=NULL);
+   ASSERT(size>0&&size<=8);
+   ASSERT(size==8||n>>(size*8)==0);
+
+   for (i = size-1; i >= 0; i--) {
+      b = (n >> (i*8)) & 0xFF;
+      ASSERT(b>=0&&b<256);
+      fputc(b,file);
+   }
+}
+
+// end of book_compress.cpp
@@ -0,0 +1,41 @@
+
+// book_compress.h
+
+#ifndef BOOK_COMPRESS_H
+#define BOOK_COMPRESS_H
+
+// includes
+
+#include <cstddef>
+#include <cstdio>
+
+#include "book.h"
+#include "util.h"
+
+// types
+
+struct cbook_t {
+   const uint8 * data; // mapped file, NULL if the book is a plain .bin
+   size_t size;
+   int entry_nb;
+   int block_size; // book entries per block, the last block can be shorter
+   int block_nb;
+   const uint8 * index; // first key and offset of each block
+   int block; // decoded block, -1 if none
+   book_entry_t * entry;
+};
+
+// functions
+
+extern void book_compress (int argc, char * argv[]);
+extern void book_expand   (int argc, char * argv[]);
+
+extern bool cbook_open    (cbook_t * cbook, FILE * file, const char file_name[]);
+extern void cbook_close   (cbook_t * cbook);
+
+extern int  cbook_find    (cbook_t * cbook, uint64 key);
+extern void cbook_read    (cbook_t * cbook, book_entry_t * entry, int pos);
+
+#endif // !defined BOOK_COMPRESS_H
+
+// end of book_compress.h
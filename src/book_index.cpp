@@ -0,0 +1,874 @@
+
+// book_index.cpp
+
+// includes
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/mman.h>
+
+#include "book_compress.h"
+#include "book_index.h"
+#include "util.h"
+
+// constants
+
+static const int BixVersion = 2;
+
+static const int BixHeaderSize = 64; // the root starts a cache line
+static const int NodeKeys = 16; // key prefixes in a 64-byte node
+static const int NodeSize = NodeKeys * 4;
+
+static const int BlockSize = 4; // 16-byte entries, one cache line of the .bin
+
+static const int LevelMax = 32;
+static const int LevelSize = 8; // first line, bits
+static const int LineSize = 64; // rank, then 7 words of bits
+static const int LineWords = 7;
+static const int LineBits = LineWords * 64;
+static const int HashGamma = 2; // bits per key at each level, more bits mean fewer levels
+static const int HashPosSize = 4; // first entry of a key
+static const int HashExtraSize = 12; // key, first entry
+
+static const int HashLineOffset = BixHeaderSize + LevelMax * LevelSize; // a multiple of LineSize
+
+static const int BufferSize = 1 << 20;
+
+// prototypes
+
+static uint64 * read_keys   (const char bin_file_name[], int * entry_nb);
+static void   bix_name      (char name[], const char bin_file_name[]);
+
+static void   eytzinger_write (FILE * file, const char file_name[], const uint64 key[], int entry_nb);
+static int    tree_rows     (int block_nb, int row_size[]);
+static int    node_rank     (const bix_t * bix, int node, uint32 prefix);
+
+static void   hash_write    (FILE * file, const char file_name[], const uint64 key[], int entry_nb);
+static int    hash_find     (const bix_t * bix, uint64 key);
+static int    hash_index    (const bix_t * bix, uint64 key);
+static int    hash_slot     (uint64 key, int level, int bit_nb);
+
+static int    bit_count     (uint64 n);
+
+static uint64 get_integer   (const uint8 data[], int size);
+static void   put_integer   (uint8 data[], int size, uint64 n);
+static void   write_integer (FILE * file, int size, uint64 n);
+
+// functions
+
+// book_index()
+
+void book_index(int argc, char * argv[]) {
+
+   int i;
+   const char * bin_file;
+   int kind;
+
+   bin_file = NULL;
+   my_string_set(&bin_file,"book.bin");
+
+   kind = BixEytzinger;
+
+   for (i = 1; i < argc; i++) {
+
+      if (false) {
+
+      } else if (my_string_equal(argv[i],"book-index")) {
+
+         // skip
+
+      } else if (my_string_equal(argv[i],"-bin")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_index(): missing argument\n");
+
+         my_string_set(&bin_file,argv[i]);
+
+      } else if (my_string_equal(argv[i],"-type")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_index(): missing argument\n");
+
+         kind = bix_kind(argv[i]);
+         if (kind == 0) my_fatal("book_index(): unknown index type \"%s\"\n",argv[i]);
+
+      } else {
+
+         my_fatal("book_index(): unknown option \"%s\"\n",argv[i]);
+      }
+   }
+
+   bix_build(bin_file,kind);
+}
+
+// bix_kind()
+
+int bix_kind(const char name[]) {
+
+   ASSERT(name!=NULL);
+
+   // 0 if the name is unknown
+
+   if (false) {
+   } else if (my_string_equal(name,"eytzinger")) {
+      return BixEytzinger;
+   } else if (my_string_equal(name,"hash")) {
+      return BixHash;
+   }
+
+   return 0;
+}
+
+// bix_build()
+
+void bix_build(const char bin_file_name[], int kind) {
+
+   char bix_file_name[4096];
+   char tmp_name[4096+4];
+   uint64 * key;
+   int entry_nb;
+   FILE * file;
+
+   ASSERT(bin_file_name!=NULL);
+   ASSERT(kind==BixEytzinger||kind==BixHash);
+
+   key = read_keys(bin_file_name,&entry_nb);
+
+   // write a temporary file and rename it, book_open() may be reading the old one
+
+   bix_name(bix_file_name,bin_file_name);
+   sprintf(tmp_name,"%.4000s.tmp",bix_file_name);
+
+   file = fopen(tmp_name,"wb");
+   if (file == NULL) my_fatal("bix_build(): can't open file \"%s\": %s\n",tmp_name,strerror(errno));
+
+   setvbuf(file,NULL,_IOFBF,BufferSize);
+
+   if (kind == BixHash) {
+      hash_write(file,bix_file_name,key,entry_nb);
+   } else {
+      eytzinger_write(file,bix_file_name,key,entry_nb);
+   }
+
+   if (fclose(file) == EOF) my_fatal("bix_build(): fclose(): %s\n",strerror(errno));
+
+   if (rename(tmp_name,bix_file_name) != 0) {
+      my_fatal("bix_build(): can't rename \"%s\" to \"%s\": %s\n",tmp_name,bix_file_name,strerror(errno));
+   }
+
+   my_free(key);
+}
+
+// bix_open()
+
+bool bix_open(bix_t * bix, const char bin_file_name[], int book_size, uint64 first_key, uint64 last_key) {
+
+   char name[4096];
+   FILE * file;
+   long int size;
+   void * data;
+   bool ok;
+   int level;
+   uint64 first_line, bit_nb;
+   int row_size[BixRowMax];
+   int row, node_nb;
+
+   ASSERT(bix!=NULL);
+   ASSERT(bin_file_name!=NULL);
+   ASSERT(book_size>0);
+
+   // returns false if there is no usable sidecar, the caller does a plain binary search
+
+   bix->data = NULL;
+   bix->size = 0;
+   bix->kind = 0;
+   bix->block_size = 0;
+   bix->block_nb = 0;
+   bix->row_nb = 0;
+   bix->level_nb = 0;
+   bix->key_nb = 0;
+   bix->line_nb = 0;
+   bix->extra_nb = 0;
+
+   bix_name(name,bin_file_name);
+
+   file = fopen(name,"rb");
+   if (file == NULL) return false;
+
+   if (fseek(file,0,SEEK_END) == -1) my_fatal("bix_open(): fseek(): %s\n",strerror(errno));
+   size = ftell(file);
+
+   if (size < BixHeaderSize + NodeSize) {
+      my_log("POLYGLOT ignoring \"%s\", too short\n",name);
+      fclose(file);
+      return false;
+   }
+
+   data = mmap(NULL,size_t(size),PROT_READ,MAP_SHARED,fileno(file),0);
+   fclose(file); // the mapping stays
+
+   if (data == MAP_FAILED) {
+      my_log("POLYGLOT ignoring \"%s\", mmap(): %s\n",name,strerror(errno));
+      return false;
+   }
+
+   bix->data = (const uint8 *) data;
+   bix->size = size_t(size);
+   bix->kind = int(get_integer(&bix->data[4],4));
+
+   ok = get_integer(&bix->data[0],4) == uint64(BixVersion);
+
+   if (ok && bix->kind == BixEytzinger) {
+
+      bix->block_size = get_integer(&bix->data[16],4);
+      bix->block_nb = get_integer(&bix->data[20],4);
+
+      ok = bix->block_size > 0
+        && bix->block_nb == (book_size + bix->block_size - 1) / bix->block_size;
+
+      if (ok) {
+
+         bix->row_nb = tree_rows(bix->block_nb,row_size);
+
+         node_nb = 0;
+
+         for (row = 0; row < bix->row_nb; row++) {
+            bix->row[row] = node_nb;
+            node_nb += row_size[row];
+         }
+
+         ok = bix->size == size_t(BixHeaderSize) + size_t(node_nb) * NodeSize;
+      }
+
+   } else if (ok && bix->kind == BixHash && bix->size >= size_t(HashLineOffset)) {
+
+      bix->level_nb = get_integer(&bix->data[16],4);
+      bix->key_nb = get_integer(&bix->data[20],4);
+      bix->line_nb = get_integer(&bix->data[40],4);
+      bix->extra_nb = get_integer(&bix->data[44],4);
+
+      ok = bix->level_nb >= 1 && bix->level_nb <= LevelMax
+        && bix->key_nb >= 1 && bix->key_nb <= book_size
+        && bix->extra_nb >= 0 && bix->extra_nb <= bix->key_nb
+        && bix->line_nb >= 0
+        && bix->size == size_t(HashLineOffset) + size_t(bix->line_nb) * LineSize
+                      + size_t(bix->key_nb-bix->extra_nb) * HashPosSize + size_t(bix->extra_nb) * HashExtraSize;
+
+      for (level = 0; ok && level < bix->level_nb; level++) {
+         first_line = get_integer(&bix->data[BixHeaderSize+level*LevelSize],4);
+         bit_nb = get_integer(&bix->data[BixHeaderSize+level*LevelSize+4],4);
+         ok = bit_nb > 0 && first_line + (bit_nb + LineBits - 1) / LineBits <= uint64(bix->line_nb);
+      }
+
+   } else {
+
+      ok = false;
+   }
+
+   if (!ok) {
+      my_log("POLYGLOT ignoring \"%s\", built by another version or for another book\n",name);
+      bix_close(bix);
+      return false;
+   }
+
+   // a book rewritten since it was indexed, by make-book or merge-book
+
+   if (get_integer(&bix->data[8],8) != uint64(book_size)
+    || get_integer(&bix->data[24],8) != first_key
+    || get_integer(&bix->data[32],8) != last_key) {
+      my_log("POLYGLOT ignoring \"%s\", the book changed since it was indexed\n",name);
+      bix_close(bix);
+      return false;
+   }
+
+   return true;
+}
+
+// bix_close()
+
+void bix_close(bix_t * bix) {
+
+   ASSERT(bix!=NULL);
+
+   if (bix->data != NULL && munmap((void *) bix->data,bix->size) == -1) {
+      my_fatal("bix_close(): munmap(): %s\n",strerror(errno));
+   }
+
+   bix->data = NULL;
+   bix->size = 0;
+   bix->kind = 0;
+   bix->block_size = 0;
+   bix->block_nb = 0;
+   bix->row_nb = 0;
+   bix->level_nb = 0;
+   bix->key_nb = 0;
+   bix->line_nb = 0;
+   bix->extra_nb = 0;
+}
+
+// bix_find()
+
+int bix_find(const bix_t * bix, uint64 key) {
+
+   uint32 prefix;
+   int row;
+   int node;
+   int block;
+
+   ASSERT(bix!=NULL);
+   ASSERT(bix->data!=NULL);
+
+   // a hash index gives the first entry of the key itself, or of whatever
+   // key shares its slot, -1 if it gives none; the caller checks the entry
+
+   if (bix->kind == BixHash) return hash_find(bix,key);
+
+   // lower bound of the key prefix, one cache line per row: the prefixes
+   // of a node below the key pick one of its 17 children, and in the last
+   // row they count the blocks before the first one whose prefix is not
+   // smaller (block_nb if there is none)
+
+   prefix = uint32(key >> 32);
+
+   node = 0;
+
+   for (row = 0; row < bix->row_nb - 1; row++) {
+      node = node * (NodeKeys + 1) + node_rank(bix,bix->row[row]+node,prefix);
+   }
+
+   block = node * NodeKeys + node_rank(bix,bix->row[row]+node,prefix);
+   ASSERT(block>=0&&block<=bix->block_nb);
+
+   // the key can start in the block before, whose first key is smaller
+
+   if (block > 0) block--;
+
+   return block * bix->block_size;
+}
+
+// read_keys()
+
+static uint64 * read_keys(const char bin_file_name[], int * entry_nb) {
+
+   FILE * bin_file;
+   uint8 * buffer;
+   uint64 * key;
+   int pos, size, i;
+   cbook_t cbook[1];
+
+   ASSERT(bin_file_name!=NULL);
+   ASSERT(entry_nb!=NULL);
+
+   bin_file = fopen(bin_file_name,"rb");
+   if (bin_file == NULL) my_fatal("read_keys(): can't open file \"%s\": %s\n",bin_file_name,strerror(errno));
+
+   if (cbook_open(cbook,bin_file,bin_file_name)) {
+      my_fatal("read_keys(): \"%s\" is a compressed book, it has its own index\n",bin_file_name);
+   }
+
+   if (fseek(bin_file,0,SEEK_END) == -1) my_fatal("read_keys(): fseek(): %s\n",strerror(errno));
+   *entry_nb = ftell(bin_file) / 16;
+   if (*entry_nb == 0) my_fatal("read_keys(): empty file\n");
+   rewind(bin_file);
+
+   buffer = (uint8 *) my_malloc(BufferSize);
+   key = (uint64 *) my_malloc(*entry_nb*sizeof(uint64));
+
+   printf("reading %d entries ...\n",*entry_nb);
+
+   for (pos = 0; pos < *entry_nb; pos += size) {
+
+      size = *entry_nb - pos;
+      if (size > BufferSize / 16) size = BufferSize / 16;
+
+      if (fread(buffer,16,size,bin_file) != size_t(size)) my_fatal("read_keys(): fread(): %s\n",strerror(errno));
+
+      for (i = 0; i < size; i++) {
+         key[pos+i] = get_integer(&buffer[i*16],8);
+         if (pos + i > 0 && key[pos+i] < key[pos+i-1]) my_fatal("read_keys(): \"%s\" is not sorted by key\n",bin_file_name);
+      }
+   }
+
+   fclose(bin_file);
+   my_free(buffer);
+
+   return key;
+}
+
+// bix_name()
+
+static void bix_name(char name[], const char bin_file_name[]) {
+
+   ASSERT(name!=NULL);
+   ASSERT(bin_file_name!=NULL);
+
+   sprintf(name,"%.4000s.bix",bin_file_name);
+}
+
+// eytzinger_write()
+
+static void eytzinger_write(FILE * file, const char file_name[], const uint64 key[], int entry_nb) {
+
+   int block_nb;
+   int row_size[BixRowMax];
+   int row_nb, row;
+   int node_nb, node;
+   sint64 span; // blocks under a node of the row
+   sint64 block;
+   int i;
+
+   ASSERT(file!=NULL);
+   ASSERT(file_name!=NULL);
+   ASSERT(key!=NULL);
+   ASSERT(entry_nb>0);
+
+   block_nb = (entry_nb + BlockSize - 1) / BlockSize;
+
+   row_nb = tree_rows(block_nb,row_size);
+
+   write_integer(file,4,BixVersion);
+   write_integer(file,4,BixEytzinger);
+   write_integer(file,8,entry_nb);
+   write_integer(file,4,BlockSize);
+   write_integer(file,4,block_nb);
+   write_integer(file,8,key[0]);
+   write_integer(file,8,key[entry_nb-1]);
+
+   for (i = 40; i < BixHeaderSize; i += 8) write_integer(file,8,0);
+
+   // the rows from the root down, a node of the last row holds the key prefix
+   // of 16 blocks, one above it the smallest prefix under each of its 17
+   // children but the first; missing ones are ~0, never below a key
+
+   span = NodeKeys;
+   for (row = 1; row < row_nb; row++) span *= NodeKeys + 1;
+
+   node_nb = 0;
+
+   for (row = 0; row < row_nb; row++) {
+
+      for (node = 0; node < row_size[row]; node++) {
+
+         for (i = 0; i < NodeKeys; i++) {
+
+            if (row == row_nb - 1) {
+               block = sint64(node) * NodeKeys + i;
+            } else {
+               block = (sint64(node) * (NodeKeys + 1) + i + 1) * (span / (NodeKeys + 1));
+            }
+
+            write_integer(file,4,(block < block_nb) ? (key[block*BlockSize] >> 32) : 0xFFFFFFFF);
+         }
+      }
+
+      node_nb += row_size[row];
+      span /= NodeKeys + 1;
+   }
+
+   ASSERT(ftell(file)==BixHeaderSize+long(node_nb)*NodeSize);
+
+   printf("%d block%s of %d entries indexed in \"%s\", %d row%s of %d nodes.\n",block_nb,(block_nb>1)?"s":"",BlockSize,file_name,row_nb,(row_nb>1)?"s":"",node_nb);
+}
+
+// tree_rows()
+
+static int tree_rows(int block_nb, int row_size[]) {
+
+   int row_nb;
+   int size;
+   int row;
+
+   ASSERT(block_nb>0);
+   ASSERT(row_size!=NULL);
+
+   // nodes in each row, the root first; returns the number of rows
+
+   row_nb = 0;
+
+   for (size = (block_nb + NodeKeys - 1) / NodeKeys; true; size = (size + NodeKeys) / (NodeKeys + 1)) {
+      ASSERT(row_nb<BixRowMax);
+      row_size[row_nb++] = size;
+      if (size == 1) break;
+   }
+
+   for (row = 0; row < row_nb / 2; row++) {
+      size = row_size[row];
+      row_size[row] = row_size[row_nb-1-row];
+      row_size[row_nb-1-row] = size;
+   }
+
+   return row_nb;
+}
+
+// node_rank()
+
+static int node_rank(const bix_t * bix, int node, uint32 prefix) {
+
+   const uint8 * data;
+   int rank;
+   int i;
+
+   ASSERT(bix!=NULL);
+   ASSERT(node>=0);
+
+   // prefixes of the node below the given one, they are sorted
+
+   data = &bix->data[BixHeaderSize+size_t(node)*NodeSize];
+
+   rank = 0;
+
+   for (i = 0; i < NodeKeys; i++) {
+      rank += uint32(get_integer(&data[i*4],4)) < prefix;
+   }
+
+   return rank;
+}
+
+// hash_write()
+
+static void hash_write(FILE * file, const char file_name[], const uint64 key[], int entry_nb) {
+
+   uint64 * distinct;
+   int * first;
+   int key_nb;
+   int * work;
+   int work_nb, keep_nb;
+   uint64 * word;
+   uint64 * level_word;
+   uint64 * collide;
+   int level_line[LevelMax], level_bits[LevelMax];
+   int level_nb, line_nb, extra_nb;
+   int bit_nb, bit;
+   int pos, i, w;
+   size_t size;
+   uint8 * data;
+   uint8 * line;
+   uint64 rank;
+   bix_t bix[1];
+   int index;
+
+   ASSERT(file!=NULL);
+   ASSERT(file_name!=NULL);
+   ASSERT(key!=NULL);
+   ASSERT(entry_nb>0);
+
+   // the distinct keys and their first entry
+
+   distinct = (uint64 *) my_malloc(entry_nb*sizeof(uint64));
+   first = (int *) my_malloc(entry_nb*sizeof(int));
+
+   key_nb = 0;
+
+   for (pos = 0; pos < entry_nb; pos++) {
+      if (pos == 0 || key[pos] != key[pos-1]) {
+         distinct[key_nb] = key[pos];
+         first[key_nb] = pos;
+         key_nb++;
+      }
+   }
+
+   // BBHash: each level is a bit array of HashGamma bits per key still to
+   // place, a key whose slot no other key hits gets that bit, the others go
+   // on to the next level; the index of a key is the rank of its bit
+
+   work = (int *) my_malloc(key_nb*sizeof(int));
+   for (i = 0; i < key_nb; i++) work[i] = i;
+   work_nb = key_nb;
+
+   word = NULL;
+   level_nb = 0;
+   line_nb = 0;
+
+   while (work_nb > 0 && level_nb < LevelMax) {
+
+      bit_nb = ((work_nb * HashGamma + LineBits - 1) / LineBits) * LineBits;
+
+      level_line[level_nb] = line_nb;
+      level_bits[level_nb] = bit_nb;
+
+      word = (uint64 *) my_realloc(word,size_t(line_nb+bit_nb/LineBits)*LineWords*sizeof(uint64));
+      level_word = &word[size_t(line_nb)*LineWords];
+      memset(level_word,0,bit_nb/8);
+
+      collide = (uint64 *) my_malloc(bit_nb/8);
+      memset(collide,0,bit_nb/8);
+
+      for (i = 0; i < work_nb; i++) {
+
+         bit = hash_slot(distinct[work[i]],level_nb,bit_nb);
+
+         if ((level_word[bit/64] >> (bit%64) & 1) != 0) {
+            collide[bit/64] |= uint64(1) << (bit%64);
+         } else {
+            level_word[bit/64] |= uint64(1) << (bit%64);
+         }
+      }
+
+      for (w = 0; w < bit_nb / 64; w++) level_word[w] &= ~collide[w];
+
+      keep_nb = 0;
+
+      for (i = 0; i < work_nb; i++) {
+         bit = hash_slot(distinct[work[i]],level_nb,bit_nb);
+         if ((collide[bit/64] >> (bit%64) & 1) != 0) work[keep_nb++] = work[i];
+      }
+
+      my_free(collide);
+
+      work_nb = keep_nb;
+      line_nb += bit_nb / LineBits;
+      level_nb++;
+   }
+
+   extra_nb = work_nb; // still in key order
+
+   // the file image, so that the positions are filled with the lookup code
+
+   size = size_t(HashLineOffset) + size_t(line_nb) * LineSize
+        + size_t(key_nb-extra_nb) * HashPosSize + size_t(extra_nb) * HashExtraSize;
+
+   data = (uint8 *) my_malloc(size);
+   memset(data,0,size);
+
+   put_integer(&data[0],4,BixVersion);
+   put_integer(&data[4],4,BixHash);
+   put_integer(&data[8],8,entry_nb);
+   put_integer(&data[16],4,level_nb);
+   put_integer(&data[20],4,key_nb);
+   put_integer(&data[24],8,key[0]);
+   put_integer(&data[32],8,key[entry_nb-1]);
+   put_integer(&data[40],4,line_nb);
+   put_integer(&data[44],4,extra_nb);
+
+   for (i = 0; i < level_nb; i++) {
+      put_integer(&data[BixHeaderSize+i*LevelSize],4,level_line[i]);
+      put_integer(&data[BixHeaderSize+i*LevelSize+4],4,level_bits[i]);
+   }
+
+   rank = 0;
+
+   for (i = 0; i < line_nb; i++) {
+
+      line = &data[HashLineOffset+size_t(i)*LineSize];
+      put_integer(&line[0],8,rank);
+
+      for (w = 0; w < LineWords; w++) {
+         put_integer(&line[8+w*8],8,word[size_t(i)*LineWords+w]);
+         rank += bit_count(word[size_t(i)*LineWords+w]);
+      }
+   }
+
+   ASSERT(rank==uint64(key_nb-extra_nb));
+
+   bix->data = data;
+   bix->size = size;
+   bix->kind = BixHash;
+   bix->block_size = 0;
+   bix->block_nb = 0;
+   bix->row_nb = 0;
+   bix->level_nb = level_nb;
+   bix->key_nb = key_nb;
+   bix->line_nb = line_nb;
+   bix->extra_nb = extra_nb;
+
+   for (i = 0; i < key_nb; i++) {
+      index = hash_index(bix,distinct[i]);
+      if (index >= 0) put_integer(&data[HashLineOffset+size_t(line_nb)*LineSize+size_t(index)*HashPosSize],4,first[i]);
+   }
+
+   for (i = 0; i < extra_nb; i++) {
+      line = &data[size-size_t(extra_nb-i)*HashExtraSize];
+      put_integer(&line[0],8,distinct[work[i]]);
+      put_integer(&line[8],4,first[work[i]]);
+   }
+
+   if (fwrite(data,1,size,file) != size) my_fatal("hash_write(): fwrite(): %s\n",strerror(errno));
+
+   my_free(data);
+   my_free(word);
+   my_free(work);
+   my_free(distinct);
+   my_free(first);
+
+   printf("%d key%s in %d level%s, %.1f bits per key, indexed in \"%s\".\n",
+          key_nb,(key_nb>1)?"s":"",level_nb,(level_nb>1)?"s":"",double(size)*8.0/double(key_nb),file_name);
+}
+
+// hash_find()
+
+static int hash_find(const bix_t * bix, uint64 key) {
+
+   const uint8 * extra;
+   int index;
+   int left, right, mid;
+
+   ASSERT(bix!=NULL);
+   ASSERT(bix->kind==BixHash);
+
+   index = hash_index(bix,key);
+
+   if (index >= 0) {
+      return int(get_integer(&bix->data[HashLineOffset+size_t(bix->line_nb)*LineSize+size_t(index)*HashPosSize],4));
+   }
+
+   // the few keys that collided at every level
+
+   extra = &bix->data[bix->size-size_t(bix->extra_nb)*HashExtraSize];
+
+   left = 0;
+   right = bix->extra_nb;
+
+   while (left < right) {
+
+      mid = (left + right) / 2;
+
+      if (get_integer(&extra[mid*HashExtraSize],8) < key) {
+         left = mid+1;
+      } else {
+         right = mid;
+      }
+   }
+
+   if (left < bix->extra_nb && get_integer(&extra[left*HashExtraSize],8) == key) {
+      return int(get_integer(&extra[left*HashExtraSize+8],4));
+   }
+
+   return -1;
+}
+
+// hash_index()
+
+static int hash_index(const bix_t * bix, uint64 key) {
+
+   int level;
+   int bit;
+   const uint8 * line;
+   uint64 word;
+   uint64 rank;
+   int i;
+
+   ASSERT(bix!=NULL);
+   ASSERT(bix->kind==BixHash);
+
+   // one cache line per level, most keys are placed by the first one
+
+   for (level = 0; level < bix->level_nb; level++) {
+
+      bit = hash_slot(key,level,int(get_integer(&bix->data[BixHeaderSize+level*LevelSize+4],4)));
+
+      line = &bix->data[HashLineOffset+(get_integer(&bix->data[BixHeaderSize+level*LevelSize],4)+bit/LineBits)*LineSize];
+      bit %= LineBits;
+
+      word = get_integer(&line[8+(bit/64)*8],8);
+
+      if ((word >> (bit%64) & 1) != 0) {
+
+         rank = get_integer(&line[0],8);
+
+         for (i = 0; i < bit / 64; i++) rank += bit_count(get_integer(&line[8+i*8],8));
+         rank += bit_count(word & ((uint64(1) << (bit%64)) - 1));
+
+         ASSERT(rank<uint64(bix->key_nb-bix->extra_nb));
+
+         return int(rank);
+      }
+   }
+
+   return -1;
+}
+
+// hash_slot()
+
+static int hash_slot(uint64 key, int level, int bit_nb) {
+
+   uint64 hash;
+
+   ASSERT(level>=0&&level<LevelMax);
+   ASSERT(bit_nb>0);
+
+   // the keys are random already, but two keys that share a slot at one
+   // level must not share one at the next, so each level mixes them again
+
+   hash = key + uint64(level+1) * U64(0x9E3779B97F4A7C15);
+
+   hash ^= hash >> 33;
+   hash *= U64(0xFF51AFD7ED558CCD);
+   hash ^= hash >> 33;
+   hash *= U64(0xC4CEB9FE1A85EC53);
+   hash ^= hash >> 33;
+
+   return int(((hash >> 32) * uint64(bit_nb)) >> 32);
+}
+
+// bit_count()
+
+static int bit_count(uint64 n) {
+
+#if defined(__GNUC__)
+   return __builtin_popcountll(n);
+#else
+   int count;
+   for (count = 0; n != 0; n &= n - 1) count++;
+   return count;
+#endif
+}
+
+// get_integer()
+
+static uint64 get_integer(const uint8 data[], int size) {
+
+   uint64 n;
+   int i;
+
+   ASSERT(data!=NULL);
+   ASSERT(size>0&&size<=8);
+
+   // big-endian, like every polyglot file
+
+   n = 0;
+
+   for (i = 0; i < size; i++) {
+      n = (n << 8) | data[i];
+   }
+
+   return n;
+}
+
+// put_integer()
+
+static void put_integer(uint8 data[], int size, uint64 n) {
+
+   int i;
+
+   ASSERT(data!=NULL);
+   ASSERT(size>0&&size<=8);
+   ASSERT(size==8||n>>(size*8)==0);
+
+   for (i = size-1; i >= 0; i--) {
+      data[i] = uint8(n & 0xFF);
+      n >>= 8;
+   }
+}
+
+// write_integer()
+
+static void write_integer(FILE * file, int size, uint64 n) {
+
+   int i;
+   int b;
+
+   ASSERT(file!=NULL);
+   ASSERT(size>0&&size<=8);
+   ASSERT(size==8||n>>(size*8)==0);
+
+   for (i = size-1; i >= 0; i--) {
+      b = (n >> (i*8)) & 0xFF;
+      ASSERT(b>=0&&b<256);
+      fputc(b,file);
+   }
+}
+
+// end of book_index.cpp
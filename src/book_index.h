@@ -0,0 +1,50 @@
+
+// book_index.h
+
+#ifndef BOOK_INDEX_H
+#define BOOK_INDEX_H
+
+// includes
+
+#include <cstddef>
+
+#include "util.h"
+
+// constants
+
+const int BixEytzinger = 1; // sorted tree of block prefixes, the book is scanned from a block
+const int BixHash = 2; // minimal perfect hash of the keys, to their first entry
+
+const int BixRowMax = 8; // BixEytzinger: enough for 2^31 entries
+
+// types
+
+struct bix_t {
+   const uint8 * data; // mapped sidecar, NULL if there is none
+   size_t size;
+   int kind;
+   int block_size; // BixEytzinger: book entries per indexed block
+   int block_nb;
+   int row_nb; // BixEytzinger: rows of nodes, the root first and the blocks last
+   int row[BixRowMax]; // BixEytzinger: first node of each row
+   int level_nb; // BixHash: bit arrays tried in turn
+   int key_nb; // distinct keys of the book
+   int line_nb; // cache lines of bits, each with the rank of its first bit
+   int extra_nb; // keys no level could place, in a sorted list
+};
+
+// functions
+
+extern void book_index (int argc, char * argv[]);
+
+extern int  bix_kind   (const char name[]);
+extern void bix_build  (const char bin_file_name[], int kind);
+
+extern bool bix_open   (bix_t * bix, const char bin_file_name[], int book_size, uint64 first_key, uint64 last_key);
+extern void bix_close  (bix_t * bix);
+
+extern int  bix_find   (const bix_t * bix, uint64 key);
+
+#endif // !defined BOOK_INDEX_H
+
+// end of book_index.h
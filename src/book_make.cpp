@@ -3,23 +3,38 @@
 
 // includes
 
+#include <cctype>
 #include <cerrno>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <set>
+#include <algorithm>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <vector>
 
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
 
 #include "board.h"
+#include "book_index.h"
 #include "book_make.h"
+#include "dedupe.h"
 #include "move.h"
 #include "move_do.h"
 #include "move_legal.h"
 #include "pgn.h"
+#include "posix.h"
+#include "posting.h"
+#include "radix.h"
 #include "san.h"
+#include "sketch.h"
 #include "util.h"
 
 // constants
@@ -27,25 +42,182 @@
 using namespace std;
 static const int COUNT_MAX = 16384;
 
-static const int NIL = -1;
+static const int GroupSize = 16; // slots per control group, one SSE2 compare
+static const uint8 CtrlEmpty = 0x80;
+static const uint8 CtrlMoved = 0xFE; // drained to the new table during a resize
+static const int MigrateGroups = 32; // old groups moved per find_entry() call
+
+static const int ThreadMax = 64;
+static const int MoveMax = 256; // distinct moves per position
+static const int RunMax = 1024; // spilled runs per thread, merged into one when RunFanIn is reached
+static const int FileReserve = 16; // descriptors left for the PGN file, the book, the log, ...
+
+static const int FileBufferSize = 1 << 20;
+
+static const int FlushGames = 100000; // games per position index chunk
+static const size_t BatchSize = 4 << 20; // bytes per leveldb::WriteBatch
+
+static const int IndexFormatText = 1;
+static const int IndexFormatBinary = 2;
+
+static const char IndexTagPosition = 0x00; // binary format key prefixes
+static const char IndexTagGame = 0x01;
+static const int RunBufferSize = 1 << 16;
+
+static const int PipeGames = 256; // games per -pipeline batch
+
+static const int StateVersion = 2; // -append state file, see book_insert_runs()
 
 // types
 
+enum phase_t {
+   PHASE_COUNT,
+   PHASE_PARSE,
+   PHASE_DECODE,
+   PHASE_INSERT,
+   PHASE_FLUSH,
+   PHASE_SPILL,
+   PHASE_MERGE,
+   PHASE_SORT,
+   PHASE_SAVE,
+   PHASE_NB
+};
+
 struct entry_t {
    uint64 key;
+   uint32 n; // exact until the book is written, see rescale_position()
+   uint32 sum;
    uint16 move;
-   uint16 n;
-   uint16 sum;
    uint16 colour;
-   set<int> * game_ids;
 };
 
 struct book_t {
    int size;
-   int alloc;
-   uint32 mask;
-   entry_t * entry;
-   sint32 * hash;
+   int alloc; // slots, a power of two
+   entry_t * entry; // open addressing, dense after book_pack()
+   uint8 * ctrl; // CtrlEmpty or the key tag of each slot
+   posting_t * games; // games of each slot, NULL but with -leveldb
+   int old_alloc;
+   entry_t * old_entry; // previous table while it is drained
+   uint8 * old_ctrl;
+   posting_t * old_games;
+   int old_group;
+   bool packed;
+   posting_pool_t pool;
+};
+
+struct worker_t {
+   pthread_t thread;
+   int id;
+   const char * file_name;
+   long int start_pos;
+   long int stop_pos;
+   int game_nb;
+   int run_size;
+   int run_nb;
+   int spill_nb; // run files written, to name them
+   const char * run_name[RunMax];
+   book_t book[1];
+};
+
+struct run_t {
+   FILE * file; // spilled run or -append state, NULL for an in-memory table
+   const book_t * book;
+   int pos;
+   entry_t entry[1];
+};
+
+struct token_t {
+   int text; // in batch_t::text
+   long int pos; // in the PGN file
+};
+
+struct ply_t {
+   uint64 key;
+   uint16 move;
+   uint16 colour;
+   bool illegal;
+};
+
+struct batch_t {
+   int state;
+   int game_nb;
+   int result[PipeGames];
+   int end[PipeGames]; // one past the last move of each game
+   std::string value[PipeGames];
+   uint64 hash[PipeGames]; // -dedupe, see game_hash()
+   std::string text; // NUL-terminated SAN moves
+   std::vector<token_t> token;
+   std::vector<ply_t> ply; // filled by the decoders, one per token
+};
+
+struct stamp_t {
+   double real;
+   double cpu; // of the calling thread
+};
+
+struct stats_t {
+   pthread_mutex_t mutex;
+   my_timer_t timer[1]; // whole build
+   double insert_start; // for the progress lines
+   double real[PHASE_NB]; // summed over the threads that run each phase
+   double cpu[PHASE_NB];
+   int game_nb;
+   sint64 ply_nb;
+   sint64 entry_nb; // of every table, when it is packed
+   sint64 slot_nb;
+   sint64 probe_nb; // control groups probed to reach each entry
+   int probe_max;
+   sint64 user_bytes; // handed to leveldb
+   sint64 disk_bytes; // written by leveldb, see count_env_t
+};
+
+// leveldb files that add up their size in Stats, for the write amplification
+
+class count_file_t : public leveldb::WritableFile {
+
+public:
+
+   explicit count_file_t(leveldb::WritableFile * file) : file(file) {}
+   ~count_file_t() { delete file; }
+
+   leveldb::Status Append(const leveldb::Slice & data);
+   leveldb::Status Close() { return file->Close(); }
+   leveldb::Status Flush() { return file->Flush(); }
+   leveldb::Status Sync() { return file->Sync(); }
+
+private:
+
+   leveldb::WritableFile * file;
+};
+
+class count_env_t : public leveldb::EnvWrapper {
+
+public:
+
+   count_env_t() : leveldb::EnvWrapper(leveldb::Env::Default()) {}
+
+   leveldb::Status NewWritableFile(const std::string & name, leveldb::WritableFile * * file);
+};
+
+struct pipe_t {
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+   pthread_t reader;
+   pthread_t decoder[ThreadMax];
+   const char * file_name;
+   long int start_pos;
+   long int stop_pos;
+   bool header;
+   bool where_open;
+   pgn_t where[1]; // line numbers for illegal moves
+   bool eof;
+   int read_nb;
+   int decode_nb;
+   int done_nb;
+   int game;
+   int depth;
+   batch_t * batch;
 };
 
 // variables
@@ -55,6 +227,33 @@ static int MinGame;
 static double MinScore;
 static bool RemoveWhite, RemoveBlack;
 static bool Uniform;
+static int Threads;
+static int MaxMemory;
+static bool Append;
+static int SketchMemory;
+static int Decoders;
+static int IndexFormat;
+static std::vector<std::string> IndexTags; // extra tags in the game values
+static const char * RunPrefix;
+static int RunFanIn; // -max-memory: runs a thread merges at once
+
+static const char * StatsFile; // -stats-json, NULL if off
+static int BookIndexKind; // -book-index, 0 if off
+static stats_t Stats[1];
+
+static const char * const PhaseName[PHASE_NB] = {
+   "count", "parse", "decode", "insert", "flush", "spill", "merge", "sort", "save",
+};
+
+static int DedupeMemory;
+static std::vector<std::string> DedupeTags;
+static int DuplicateNb;
+
+static int MinElo; // header filters, see game_match()
+static const char * DateFrom;
+static const char * DateTo;
+static const char * EventType;
+static const char * GameResult;
 
 static enum STORAGE
   {
@@ -62,28 +261,115 @@ static enum STORAGE
   } Storage;
 
 static book_t Book[1];
+static sketch_t Sketch[1];
+static dedupe_t Dedupe[1];
 //static leveldb::DB *BookLevelDb;
 
 // prototypes
 
-static void   book_clear    ();
+static uint64 bench_random  (uint64 seed);
+
+static void   book_clear    (book_t * book);
+static void   book_free     (book_t * book);
 static void   book_insert   (const char pgn_file_name[], const char level_db_file_name[]);
-static void   book_filter   ();
+static void   book_insert_runs (const char file_name[], const char bin_file_name[]);
 static void   book_sort     ();
-static void   book_save     (const char file_name[], const char leveldb_file[]);
-
-static int    find_entry    (const board_t * board, int move);
-static void   resize        ();
-static void   halve_stats   (uint64 key);
-
-static bool   keep_entry    (int pos);
+static void   entry_sort    (entry_t entry[], posting_t games[], int size, int threads);
+static int    sort_threads  ();
+static void   book_save     (const char file_name[]);
+
+static void   book_count    (const char file_name[]);
+static void * count_loop    (void * arg);
+static void   count_game    (pgn_t * pgn);
+
+static bool   next_game     (pgn_t * pgn);
+static bool   game_match    (const pgn_t * pgn);
+static bool   date_known    (const char date[], int size);
+static bool   date_valid    (const char date[]);
+
+static bool   insert_game   (book_t * book, pgn_t * pgn, int game_nb, stamp_t * stamp);
+static bool   stream_game   (book_t * book, pgn_t * pgn, int game_nb);
+static void   insert_move   (book_t * book, const ply_t * ply, int result, int game_nb);
+static int    game_result   (const pgn_t * pgn);
+
+static uint64 game_text     (pgn_t * pgn, bool tail);
+static uint64 game_hash     (uint64 text, uint64 moves);
+static uint64 hash_string   (uint64 hash, const char string[], int length);
+static uint64 hash_move     (uint64 hash, int move);
+
+static void   pipe_start    (pipe_t * pipe, const char file_name[], long int start_pos, long int stop_pos, bool header);
+static bool   pipe_next_game (pipe_t * pipe, const batch_t * * batch, int * game);
+static long int pipe_stop   (pipe_t * pipe);
+static void * pipe_reader   (void * arg);
+static void * pipe_decoder  (void * arg);
+static void   pipe_decode   (batch_t * batch);
+static void   pipe_illegal  (pipe_t * pipe, const batch_t * batch, int ply);
+
+static void   index_flush   (leveldb::DB * db, leveldb::WriteBatch * batch, book_t * book, int chunk_nb);
+static void   index_write   (leveldb::DB * db, leveldb::WriteBatch * batch);
+static long int index_read  (leveldb::DB * db, const char key[]);
+static std::string index_read_string (leveldb::DB * db, const char key[]);
+static void   tag_list_set  (std::vector<std::string> & tags, const char list[], const char option[]);
+
+static std::string game_key      (int game_nb);
+static std::string game_value    (const pgn_t * pgn);
+static std::string position_key  (uint64 key, int chunk_nb);
+static std::string position_value (const book_t * book, int first, int last);
+
+static void   stats_init    ();
+static void   stats_start   (stamp_t * stamp);
+static void   stats_phase   (int phase, stamp_t * stamp);
+static void   stats_game    (int ply_nb);
+static void   stats_table   (const book_t * book);
+static void   stats_progress (const book_t * book, int game_nb);
+static void   stats_save    (const char file_name[]);
+
+static void   put_varint    (std::string & s, uint64 n);
+static void   put_string    (std::string & s, const char string[]);
+static void   put_integer   (std::string & s, int size, uint64 n);
+
+static void * worker_loop   (void * arg);
+static void   worker_spill  (worker_t * worker);
+static void   merge_files   (const char * name[], int name_nb, const char out_name[]);
+
+static int    merge_runs    (run_t run[], int run_nb, FILE * file, FILE * state);
+static void   merge_position (entry_t move[], int move_nb, FILE * file, FILE * state, int * kept);
+static void   rescale_position (entry_t move[], int move_nb);
+
+static bool   run_next      (run_t * run);
+static void   heap_down     (run_t * heap[], int size, int i);
+
+static entry_t * find_entry (book_t * book, uint64 key, int move, int colour);
+static void   book_grow     (book_t * book);
+static void   book_migrate  (book_t * book, int group_nb);
+static void   book_pack     (book_t * book);
+static double book_bytes    (const book_t * book);
+static int    slot_bytes    (const book_t * book);
+static posting_t * entry_games (book_t * book, const entry_t * entry);
+
+static int    table_find    (const entry_t entry[], const uint8 ctrl[], int alloc, uint64 key, int move);
+static int    table_slot    (const uint8 ctrl[], int alloc, uint64 key);
+static uint32 group_match   (const uint8 ctrl[], int tag);
+static int    first_bit     (uint32 bits);
+static int    key_tag       (uint64 key);
+static int    key_group     (uint64 key, int mask);
+
+
+static bool   keep_entry    (const entry_t * entry);
 
 static int    entry_score    (const entry_t * entry);
 
 static int    key_compare   (const void * p1, const void * p2);
+static int    move_compare  (const void * p1, const void * p2);
 
+static uint64 read_integer  (FILE * file, int size);
 static void   write_integer (FILE * file, int size, uint64 n);
 
+static bool   read_record   (FILE * file, entry_t * entry);
+static void   write_record  (FILE * file, const entry_t * entry);
+static uint32 read_varint   (FILE * file);
+static void   write_varint  (FILE * file, uint32 n);
+
 // functions
 
 // book_make()
@@ -94,6 +380,7 @@ void book_make(int argc, char * argv[]) {
    const char * pgn_file;
    const char * bin_file;
    const char * leveldb_file;
+   stamp_t stamp[1];
 
    pgn_file = NULL;
    my_string_set(&pgn_file,"book.pgn");
@@ -110,8 +397,28 @@ void book_make(int argc, char * argv[]) {
    RemoveWhite = false;
    RemoveBlack = false;
    Uniform = false;
+   Threads = 1;
+   MaxMemory = 0;
+   Append = false;
+   SketchMemory = 0;
+   Decoders = 0;
+   IndexFormat = IndexFormatText;
+   IndexTags.clear();
    Storage = POLYGLOT;
 
+   DedupeMemory = 0;
+   DedupeTags.clear();
+   DuplicateNb = 0;
+
+   StatsFile = NULL;
+   BookIndexKind = 0;
+
+   MinElo = 0;
+   DateFrom = NULL;
+   DateTo = NULL;
+   EventType = NULL;
+   GameResult = NULL;
+
    for (i = 1; i < argc; i++) {
 
       if (false) {
@@ -172,518 +479,3123 @@ void book_make(int argc, char * argv[]) {
 
          Uniform = true;
 
-      } else if (my_string_equal(argv[i],"-leveldb")) {             
+      } else if (my_string_equal(argv[i],"-threads")) {
+
          i++;
-         if (argv[i] == NULL) my_fatal("book_make(): missing argument leveldb\n");
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
 
-         my_string_set(&leveldb_file,argv[i]);
-         Storage = LEVELDB;
-      } else {
-         my_fatal("book_make(): unknown option \"%s\"\n",argv[i]);
-      }
-   }
+         Threads = atoi(argv[i]);
+         if (Threads < 1 || Threads > ThreadMax) my_fatal("book_make(): -threads must be in [1,%d]\n",ThreadMax);
 
-//   string b_file = bin_file;
-   book_clear();
+      } else if (my_string_equal(argv[i],"-max-memory")) {
 
-   printf("inserting games ...\n");
-//   book_insert(pgn_file);
-   
-   if (Storage == LEVELDB) {
-        printf("Saving to leveldb.. \n");
-        book_insert(pgn_file, leveldb_file);
-   }
-   else {
-        book_insert(pgn_file, NULL);
-        printf("filtering entries ...\n");
-        book_filter();
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
 
-        printf("sorting entries ...\n");
-        book_sort();
+         MaxMemory = atoi(argv[i]);
+         if (MaxMemory < 1) my_fatal("book_make(): -max-memory must be at least 1 (MB)\n");
 
-        printf("saving entries ...\n");
-//        if (Storage == LEVELDB) {
-//                printf("Saving to leveldb.. \n");
-//                book_save(NULL, leveldb_file);
-//        }
-//        else {
-        book_save(bin_file, NULL);
-//        }
-    }
+      } else if (my_string_equal(argv[i],"-append")) {
 
-   
+         Append = true;
 
-   printf("all done!\n");
-}
+      } else if (my_string_equal(argv[i],"-pipeline")) {
 
-static std::string game_info_to_string(const char* a, int i, const char* b) {
-    std::ostringstream os;
-    os << a << i << b;
-    return os.str();
- }
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
 
-static std::string char_to_string(const char* a) {
-    std::ostringstream os;
-    os << a;
-    return os.str();
- }
+         Decoders = atoi(argv[i]);
+         if (Decoders < 1 || Decoders > ThreadMax) my_fatal("book_make(): -pipeline must be in [1,%d]\n",ThreadMax);
 
-static std::string int_to_string(int i) {
-    std::ostringstream os;
-    os << i;
-    return os.str();
- }
+      } else if (my_string_equal(argv[i],"-two-pass")) {
 
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
 
-static std::string uint64_to_string( uint64 value ) {
-    std::ostringstream os;
-    os << value;
-    return os.str();
-}
+         SketchMemory = atoi(argv[i]);
+         if (SketchMemory < 1) my_fatal("book_make(): -two-pass must be at least 1 (MB)\n");
 
-// book_clear()
+      } else if (my_string_equal(argv[i],"-dedupe")) {
 
-static void book_clear() {
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
 
-//  if (Storage == LEVELDB) {
-//      leveldb::Options options;
-//      options.create_if_missing = true;
-//      leveldb::DB::Open(options, bin_file, &BookLevelDb);
-//    }
-//  else {
-      int index;
+         DedupeMemory = atoi(argv[i]);
+         if (DedupeMemory < 1) my_fatal("book_make(): -dedupe must be at least 1 (MB)\n");
 
-      Book->alloc = 1;
-      Book->mask = (Book->alloc * 2) - 1;
+      } else if (my_string_equal(argv[i],"-dedupe-tags")) {
 
-      Book->entry = (entry_t *) my_malloc(Book->alloc*sizeof(entry_t));
-      Book->size = 0;
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
 
-      Book->hash = (sint32 *) my_malloc((Book->alloc*2)*sizeof(sint32));
-      for (index = 0; index < Book->alloc*2; index++) {
-          Book->hash[index] = NIL;
-        }
-//    }
-}
+         tag_list_set(DedupeTags,argv[i],"-dedupe-tags");
 
-// book_insert()
+      } else if (my_string_equal(argv[i],"-min-elo")) {
 
-static void book_insert(const char file_name[], const char leveldb_file_name[]) {
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
 
-   int game_nb = 0;
-   pgn_t pgn[1];
-   board_t board[1];
-   int ply;
-   int result;
-   char string[256];
-   int move;
-   int pos;
-   leveldb::WriteOptions writeOptions;
-   
+         MinElo = atoi(argv[i]);
+         if (MinElo < 1) my_fatal("book_make(): -min-elo must be at least 1\n");
 
-   leveldb::DB* db;
-   ASSERT(file_name!=NULL);
+      } else if (my_string_equal(argv[i],"-date-from")) {
 
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
+         if (!date_valid(argv[i])) my_fatal("book_make(): -date-from must be YYYY, YYYY.MM or YYYY.MM.DD\n");
 
-   if (leveldb_file_name!=NULL) {
-       
-       leveldb::Options options;
-       options.create_if_missing = true;
-       leveldb::Status status = leveldb::DB::Open(options, leveldb_file_name, &db);
-       std::cout << leveldb_file_name<<"\n";        
-//       assert(status.ok());
-       
-     }
+         my_string_set(&DateFrom,argv[i]);
 
-   // scan loop
+      } else if (my_string_equal(argv[i],"-date-to")) {
 
-   pgn_open(pgn,file_name);
-   
-   while (pgn_next_game(pgn)) {
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
+         if (!date_valid(argv[i])) my_fatal("book_make(): -date-to must be YYYY, YYYY.MM or YYYY.MM.DD\n");
 
-      board_start(board);
-      ply = 0;
-      result = 0;
+         my_string_set(&DateTo,argv[i]);
 
-      if (false) {
-      } else if (my_string_equal(pgn->result,"1-0")) {
-         result = +1;
-      } else if (my_string_equal(pgn->result,"0-1")) {
-         result = -1;
-      }
-      
-    if (leveldb_file_name!=NULL) {
-        
-        std::stringstream game_info;
-        game_info << pgn->white;
-        game_info << "|"<< pgn->whiteelo;
-        game_info << "|"<< pgn->black;
-        game_info << "|"<< pgn->blackelo;
-        game_info << "|"<< pgn->result;
-        
-        game_info << "|"<< pgn->date;
-        game_info << "|"<< pgn->event;
-        game_info << "|"<< pgn->site;
-        game_info << "|"<< pgn->eco;
-        game_info << "|"<< pgn->last_stream_pos;
-        game_info << "|"<< pgn->fen;
-        
-        game_info << "|"<< pgn->plycount;
-        game_info << "|"<< pgn->eventdate;
-        game_info << "|"<< pgn->eventtype;
+      } else if (my_string_equal(argv[i],"-event-type")) {
 
-        db->Put(writeOptions, game_info_to_string("game_",game_nb,"_data"), game_info.str());          
-    } 
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
 
-      while (pgn_next_move(pgn,string,256)) {
+         my_string_set(&EventType,argv[i]);
 
-         if (ply < MaxPly) {
+      } else if (my_string_equal(argv[i],"-result")) {
 
-            move = move_from_san(string,board);
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
 
-            if (move == MoveNone || !move_is_legal(move,board)) {
-               my_log("book_insert(): illegal move \"%s\" at line %d, column %d\n",string,pgn->move_line,pgn->move_column);
-            }
-            
-//            if (leveldb_file_name==NULL) {
-
-            pos = find_entry(board,move);
-
-//            if (Storage==POLYGLOT) {
-//            Book->entry[pos].n++;
-//            Book->entry[pos].sum += result+1;
-            Book->entry[pos].game_ids->insert(game_nb);
-
-//            if (Book->entry[pos].n >= COUNT_MAX) {
-//                halve_stats(board->key);
-//            }
-//            }
-//            else {
-//                std::stringstream game_id_stream;
-//                std::string currentValue;
-//                leveldb::Status s = db->Get(leveldb::ReadOptions(), uint64_to_string(board->key), &currentValue);
-//                if (s.ok()) {
-//                    game_id_stream << currentValue;
-//                }
-//                
-//                game_id_stream << game_nb << ",";
-////                for (set<int>::iterator it = Book->entry[pos].game_ids->begin(); it != Book->entry[pos].game_ids->end(); ++it) {
-////                    game_id_stream << *it << ",";
-////                }
-////                writeBatch.Put(uint64_to_string(board->key), game_id_stream.str());
-////                db->Put(writeOptions, uint64_to_string(board->key), game_id_stream.str());
-//                
-//              }
-
-           
-            move_do(board,move);
-            ply++;            
-            result = -result;
+         if (!my_string_equal(argv[i],"1-0")
+          && !my_string_equal(argv[i],"0-1")
+          && !my_string_equal(argv[i],"1/2-1/2")
+          && !my_string_equal(argv[i],"*")) {
+            my_fatal("book_make(): -result must be 1-0, 0-1, 1/2-1/2 or *\n");
          }
-      }
 
-      game_nb++;
-      if (game_nb % 10000 == 0) { 
-          printf("%d games ...\n",game_nb);
+         my_string_set(&GameResult,argv[i]);
 
-      }
+      } else if (my_string_equal(argv[i],"-leveldb")) {             
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument leveldb\n");
 
-      if (game_nb % 100000 == 0) { 
-          if (leveldb_file_name!=NULL) {
-            printf("\nPutting games into leveldb.."); 
-              
-            for (pos = 0; pos < Book->size; pos++) {
-
-                std::stringstream game_id_stream;
-                std::string currentValue;
-                leveldb::Status s = db->Get(leveldb::ReadOptions(), uint64_to_string(Book->entry[pos].key), &currentValue);
-                if (s.ok()) {
-                    game_id_stream << currentValue;
-                }
-
-                for (set<int>::iterator it = Book->entry[pos].game_ids->begin(); it != Book->entry[pos].game_ids->end(); ++it) {
-                    game_id_stream << *it << ",";
-                }
-
-                db->Put(writeOptions, uint64_to_string(Book->entry[pos].key), game_id_stream.str());
-                delete Book->entry[pos].game_ids;
-        
-            }
-            book_clear();
-
-              
-              
-              
-              
-//            db->Write(leveldb::WriteOptions(), &writeBatch);
-//            writeBatch.Clear();
-          }
-      }
-   }
+         my_string_set(&leveldb_file,argv[i]);
+         Storage = LEVELDB;
+      } else if (my_string_equal(argv[i],"-index-format")) {
 
-   pgn_close(pgn);
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
 
-   printf("%d game%s.\n", game_nb+1, (game_nb>1)?"s":"");
-   if (leveldb_file_name==NULL) {
-       printf("%d entries.\n", Book->size);
-   }
-   else {        
-        printf("Iterating thru all book positions..");
-        for (pos = 0; pos < Book->size; pos++) {
-            std::stringstream game_id_stream;
-            std::string currentValue;
-            leveldb::Status s = db->Get(leveldb::ReadOptions(), uint64_to_string(Book->entry[pos].key), &currentValue);
-            if (s.ok()) {
-                game_id_stream << currentValue;
-            }
+         if (false) {
+         } else if (my_string_equal(argv[i],"text")) {
+            IndexFormat = IndexFormatText;
+         } else if (my_string_equal(argv[i],"binary")) {
+            IndexFormat = IndexFormatBinary;
+         } else {
+            my_fatal("book_make(): unknown index format \"%s\"\n",argv[i]);
+         }
 
-            for (set<int>::iterator it = Book->entry[pos].game_ids->begin(); it != Book->entry[pos].game_ids->end(); ++it) {
-                game_id_stream << *it << ",";
-            }
+      } else if (my_string_equal(argv[i],"-index-tags")) {
 
-            db->Put(writeOptions, uint64_to_string(Book->entry[pos].key), game_id_stream.str());
-            delete Book->entry[pos].game_ids;
-        }
-        book_clear();
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
 
+         tag_list_set(IndexTags,argv[i],"-index-tags");
 
-       db->Put(writeOptions, char_to_string("total_game_count"), int_to_string(game_nb+1));
-       db->Put(writeOptions, char_to_string("pgn_filename"), char_to_string(file_name));
-       delete db;    
-   }
+      } else if (my_string_equal(argv[i],"-stats-json")) {
 
-   return;
-}
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
 
-// book_filter()
+         my_string_set(&StatsFile,argv[i]);
 
-static void book_filter() {
+      } else if (my_string_equal(argv[i],"-book-index")) {
 
-   int src, dst;
+         i++;
+         if (argv[i] == NULL) my_fatal("book_make(): missing argument\n");
 
-   // entry loop
+         BookIndexKind = bix_kind(argv[i]);
+         if (BookIndexKind == 0) my_fatal("book_make(): unknown book index type \"%s\"\n",argv[i]);
 
-   dst = 0;
+      } else {
+         my_fatal("book_make(): unknown option \"%s\"\n",argv[i]);
+      }
+   }
 
-   for (src = 0; src < Book->size; src++) {
-      if (keep_entry(src)) Book->entry[dst++] = Book->entry[src];
+//   string b_file = bin_file;
+   if (Storage == LEVELDB && Threads > 1) {
+      my_fatal("book_make(): -threads is not supported with -leveldb\n");
    }
 
-   ASSERT(dst>=0&&dst<=Book->size);
-   Book->size = dst;
+   if (Storage == POLYGLOT && !IndexTags.empty()) {
+      my_fatal("book_make(): -index-tags needs -leveldb\n");
+   }
 
-   printf("%d entries.\n",Book->size);
-}
+   if (Storage == LEVELDB && MaxMemory != 0) {
+      my_fatal("book_make(): -max-memory is not supported with -leveldb\n");
+   }
 
-// book_sort()
+   if (SketchMemory != 0 && (Storage == LEVELDB || Append)) {
+      my_fatal("book_make(): -two-pass needs every position, it can't be combined with -leveldb or -append\n");
+   }
 
-static void book_sort() {
+   if (Decoders != 0 && Storage == POLYGLOT && (Threads > 1 || MaxMemory != 0 || Append)) {
+      my_fatal("book_make(): -pipeline can't be combined with -threads, -max-memory or -append\n");
+   }
 
-   // sort keys for binary search
+   if (DedupeMemory != 0 && Threads > 1) {
+      my_fatal("book_make(): -dedupe keeps the first copy of a game, it can't be combined with -threads\n");
+   }
 
-   qsort(Book->entry,Book->size,sizeof(entry_t),&key_compare);
-}
+   if (DedupeMemory == 0 && !DedupeTags.empty()) {
+      my_fatal("book_make(): -dedupe-tags needs -dedupe\n");
+   }
 
-// book_save()
-// TODO: refactor this to 2 methods
-static void book_save(const char file_name[], const char leveldb_file[]) {
+   if (BookIndexKind != 0 && Storage == LEVELDB) {
+      my_fatal("book_make(): -book-index needs a .bin, it can't be combined with -leveldb\n");
+   }
 
-   FILE * file;
-   int pos;
+   if (StatsFile != NULL) stats_init();
 
-   leveldb::WriteOptions writeOptions = leveldb::WriteOptions();
-   leveldb::DB* BookLevelDb;
+   book_clear(Book);
 
-    if (leveldb_file != NULL) {
-        leveldb::Options options;
-        options.create_if_missing = true;
-        leveldb::Status status = leveldb::DB::Open(options, leveldb_file, &BookLevelDb);
-        assert(status.ok());
-    }
+   if (DedupeMemory != 0) dedupe_init(Dedupe,DedupeMemory);
+
+   if (SketchMemory != 0) {
+      printf("counting positions ...\n");
+      book_count(pgn_file);
+   }
+
+   printf("inserting games ...\n");
+   if (StatsFile != NULL) Stats->insert_start = now_real();
+//   book_insert(pgn_file);
    
-   if (file_name != NULL) {
-       file = fopen(file_name,"wb");
-       if (file == NULL) my_fatal("book_save(): can't open file \"%s\" for writing: %s\n",file_name,strerror(errno));
+   if (Storage == LEVELDB) {
+        printf("Saving to leveldb.. \n");
+        book_insert(pgn_file, leveldb_file);
    }
-   // entry loop
+   else if (Threads > 1 || MaxMemory != 0 || Append) {
+        book_insert_runs(pgn_file, bin_file);
+   }
+   else {
+        book_insert(pgn_file, NULL);
+        stats_start(stamp);
 
-    for (pos = 0; pos < Book->size; pos++) {
+        printf("sorting entries ...\n");
+        book_sort();
+        stats_phase(PHASE_SORT,stamp);
 
-        ASSERT(keep_entry(pos));
-        if (leveldb_file != NULL) {
-            std::stringstream game_id_stream;
-            std::string currentValue;
-            leveldb::Status s = BookLevelDb->Get(leveldb::ReadOptions(), uint64_to_string(Book->entry[pos].key), &currentValue);
-            if (s.ok()) {
-                 game_id_stream << currentValue;
-            }
-            
-            for (set<int>::iterator it = Book->entry[pos].game_ids->begin(); it != Book->entry[pos].game_ids->end(); ++it) {
-                game_id_stream << *it << ",";
-            }
-            
-            BookLevelDb->Put(writeOptions, uint64_to_string(Book->entry[pos].key), game_id_stream.str());
-        }
-
-        if (file_name != NULL) {
-
-            write_integer(file, 8, Book->entry[pos].key);
-            write_integer(file, 2, Book->entry[pos].move);
-            write_integer(file, 2, entry_score(&Book->entry[pos]));
-            write_integer(file, 2, 0);
-            write_integer(file, 2, 0);
-        }
+        printf("saving entries ...\n");
+        book_save(bin_file);
+        stats_phase(PHASE_SAVE,stamp);
     }
-   if (leveldb_file != NULL) {
-        delete BookLevelDb;
+
+   if (BookIndexKind != 0) {
+      printf("indexing entries ...\n");
+      bix_build(bin_file,BookIndexKind);
    }
-   
-  if (file_name != NULL) {
-      fclose(file);
-  }
-}
 
-// find_entry()
+   if (SketchMemory != 0) sketch_free(Sketch);
 
-static int find_entry(const board_t * board, int move) {
+   if (DedupeMemory != 0) {
 
-  uint64 key;
-  int index;
-  int pos;
+      printf("%d duplicate game%s skipped.\n",DuplicateNb,(DuplicateNb!=1)?"s":"");
 
-  ASSERT(board!=NULL);
-  ASSERT(move_is_ok(move));
+      if (Dedupe->evicted != 0) {
+         printf("the -dedupe table was full, %d games were forgotten, a larger table may find more repeats.\n",Dedupe->evicted);
+      }
 
-  ASSERT(move_is_legal(move,board));
+      dedupe_free(Dedupe);
+   }
 
-  // init
+   if (StatsFile != NULL) stats_save(StatsFile);
 
-  key = board->key;
+   printf("all done!\n");
+}
 
-  // search
+// book_bench()
 
-//  if (Storage==POLYGLOT) {
-    for (index = key & Book->mask; (pos=Book->hash[index]) != NIL; index = (index+1) & Book->mask) {
+void book_bench(int argc, char * argv[]) {
 
-        ASSERT(pos>=0&&pos<Book->size);
+   int i;
+   int entry_nb;
+   int probe_nb;
+   uint64 * key;
+   uint16 * move;
+   uint64 seed;
+   uint64 tmp_key;
+   uint16 tmp_move;
+   int pos;
+   my_timer_t timer[1];
+   double insert_time, probe_time;
+   entry_t * entry;
 
-        if (Book->entry[pos].key == key && Book->entry[pos].move == move) {
-            return pos; // found
-          }
-      }
+   entry_nb = 4000000;
+   probe_nb = 16000000;
 
-    // not found
+   for (i = 1; i < argc; i++) {
 
-    ASSERT(Book->size<=Book->alloc);
+      if (false) {
 
-    if (Book->size == Book->alloc) {
+      } else if (my_string_equal(argv[i],"book-bench")) {
 
-        // allocate more memory
+         // skip
 
-        resize();
+      } else if (my_string_equal(argv[i],"-entries")) {
 
-        for (index = key & Book->mask; Book->hash[index] != NIL; index = (index+1) & Book->mask)
-          ;
-      }
+         i++;
+         if (argv[i] == NULL) my_fatal("book_bench(): missing argument\n");
 
-    // create a new entry
+         entry_nb = atoi(argv[i]);
+         if (entry_nb < 4) my_fatal("book_bench(): -entries must be at least 4\n");
 
-    ASSERT(Book->size<Book->alloc);
-    pos = Book->size++;
+      } else if (my_string_equal(argv[i],"-probes")) {
 
-    Book->entry[pos].key = key;
-    Book->entry[pos].move = move;
-    Book->entry[pos].n = 0;
-    Book->entry[pos].sum = 0;
-    Book->entry[pos].game_ids = new set<int>();
-    Book->entry[pos].colour = board->turn;
+         i++;
+         if (argv[i] == NULL) my_fatal("book_bench(): missing argument\n");
 
-    // insert into the hash table
+         probe_nb = atoi(argv[i]);
+         if (probe_nb < 1) my_fatal("book_bench(): -probes must be at least 1\n");
 
-    ASSERT(index>=0&&index<Book->alloc*2);
-    ASSERT(Book->hash[index]==NIL);
-    Book->hash[index] = pos;
+      } else {
+         my_fatal("book_bench(): unknown option \"%s\"\n",argv[i]);
+      }
+   }
 
-    ASSERT(pos>=0&&pos<Book->size);
-//    }
-  return pos;
+   // four moves per position, inserted in random order
 
-}
+   key = (uint64 *) my_malloc(entry_nb*sizeof(uint64));
+   move = (uint16 *) my_malloc(entry_nb*sizeof(uint16));
 
-// resize()
+   seed = U64(0x9E3779B97F4A7C15);
 
-static void resize() {
+   for (i = 0; i < entry_nb; i++) {
+      if (i % 4 == 0) seed = bench_random(seed);
+      key[i] = seed;
+      move[i] = 0x100 + i % 4;
+   }
 
-   int size;
-   int pos;
-   int index;
+   for (i = entry_nb-1; i > 0; i--) {
 
-   ASSERT(Book->size==Book->alloc);
+      seed = bench_random(seed);
+      pos = int(seed % uint64(i+1));
 
-   Book->alloc *= 2;
-   Book->mask = (Book->alloc * 2) - 1;
+      tmp_key = key[i], key[i] = key[pos], key[pos] = tmp_key;
+      tmp_move = move[i], move[i] = move[pos], move[pos] = tmp_move;
+   }
+
+   book_clear(Book);
+
+   my_timer_reset(timer);
+   my_timer_start(timer);
+
+   for (i = 0; i < entry_nb; i++) {
+      entry = find_entry(Book,key[i],move[i],White);
+      entry->n++;
+   }
+
+   my_timer_stop(timer);
+   insert_time = my_timer_elapsed_real(timer);
+
+   ASSERT(Book->size==entry_nb);
+
+   // lookups of existing entries, like most of insert_move()'s calls
+
+   my_timer_reset(timer);
+   my_timer_start(timer);
+
+   for (i = 0; i < probe_nb; i++) {
+      seed = bench_random(seed);
+      pos = int(seed % uint64(entry_nb));
+      entry = find_entry(Book,key[pos],move[pos],White);
+      entry->n++;
+   }
+
+   my_timer_stop(timer);
+   probe_time = my_timer_elapsed_real(timer);
+
+   printf("%d entries, %gMB\n",Book->size,book_bytes(Book)/1048576.0);
+   printf("insert: %.2f M/s\n",double(entry_nb)/insert_time/1e6);
+   printf("probe:  %.2f M/s\n",double(probe_nb)/probe_time/1e6);
+
+   book_free(Book);
+
+   my_free(key);
+   my_free(move);
+}
+
+// san_bench()
+
+void san_bench(int argc, char * argv[]) {
+
+   int i;
+   const char * pgn_file;
+   pgn_t pgn[1];
+   char string[256];
+   std::vector<char> text;
+   std::vector<int> token;
+   std::vector<int> end;
+   board_t board[1];
+   const char * san;
+   int pass;
+   int game, ply;
+   int move;
+   int ply_nb[2];
+   uint64 sum[2];
+   double elapsed[2];
+   my_timer_t timer[1];
+
+   pgn_file = NULL;
+   my_string_set(&pgn_file,"book.pgn");
+
+   for (i = 1; i < argc; i++) {
+
+      if (false) {
+
+      } else if (my_string_equal(argv[i],"san-bench")) {
+
+         // skip
+
+      } else if (my_string_equal(argv[i],"-pgn")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("san_bench(): missing argument\n");
+
+         my_string_set(&pgn_file,argv[i]);
+
+      } else {
+         my_fatal("san_bench(): unknown option \"%s\"\n",argv[i]);
+      }
+   }
+
+   // read the SAN moves first, only decoding is timed
+
+   pgn_open(pgn,pgn_file);
+
+   while (pgn_next_game(pgn)) {
+      while (pgn_next_move(pgn,string,256)) {
+         token.push_back(text.size());
+         text.insert(text.end(),string,string+strlen(string)+1);
+      }
+      end.push_back(token.size());
+   }
+
+   pgn_close(pgn);
+
+   // pass 0 is move_from_san() + move_is_legal(), pass 1 is move_from_san_legal()
+
+   for (pass = 0; pass < 2; pass++) {
+
+      ply_nb[pass] = 0;
+      sum[pass] = 0;
+
+      my_timer_reset(timer);
+      my_timer_start(timer);
+
+      ply = 0;
+
+      for (game = 0; game < int(end.size()); game++) {
+
+         board_start(board);
+
+         for (; ply < end[game]; ply++) {
+
+            san = &text[token[ply]];
+
+            if (pass == 0) {
+               move = move_from_san(san,board);
+               if (move != MoveNone && !move_is_legal(move,board)) move = MoveNone;
+            } else {
+               move = move_from_san_legal(san,board);
+            }
+
+            if (move == MoveNone) break; // rest of the game skipped
+
+            move_do(board,move);
+
+            ply_nb[pass]++;
+            sum[pass] += board->key;
+         }
+
+         ply = end[game];
+      }
+
+      my_timer_stop(timer);
+      elapsed[pass] = my_timer_elapsed_real(timer);
+   }
+
+   if (ply_nb[0] != ply_nb[1] || sum[0] != sum[1]) my_fatal("san_bench(): the decoders disagree\n");
+
+   printf("%d games, %d plies\n",int(end.size()),ply_nb[0]);
+   printf("move_from_san + move_is_legal: %.2f M plies/s\n",double(ply_nb[0])/elapsed[0]/1e6);
+   printf("move_from_san_legal:           %.2f M plies/s\n",double(ply_nb[1])/elapsed[1]/1e6);
+}
+
+// bench_random()
+
+static uint64 bench_random(uint64 seed) {
+
+   // xorshift64
+
+   seed ^= seed << 13;
+   seed ^= seed >> 7;
+   seed ^= seed << 17;
+
+   return seed;
+}
+
+static std::string char_to_string(const char* a) {
+    std::ostringstream os;
+    os << a;
+    return os.str();
+ }
+
+static std::string int_to_string(long int i) {
+    std::ostringstream os;
+    os << i;
+    return os.str();
+ }
+
+
+
+static void write_games(std::ostream & os, const book_t * book, int pos) {
+    posting_iter_t iter[1];
+    int game;
+    posting_iter_init(iter, &book->pool, &book->games[pos]);
+    while (posting_iter_next(iter, &game)) {
+        os << game << ",";
+    }
+}
+
+// book_clear()
+
+static void book_clear(book_t * book) {
+
+   int slot;
+
+   ASSERT(book!=NULL);
+
+   book->alloc = GroupSize;
+
+   book->entry = (entry_t *) my_malloc(book->alloc*sizeof(entry_t));
+   book->size = 0;
+
+   book->ctrl = (uint8 *) my_malloc(book->alloc);
+   for (slot = 0; slot < book->alloc; slot++) {
+      book->ctrl[slot] = CtrlEmpty;
+   }
+
+   // only the leveldb index needs the games, they stay out of the 24-byte entries
+
+   book->games = (Storage == LEVELDB) ? (posting_t *) my_malloc(book->alloc*sizeof(posting_t)) : NULL;
+
+   book->old_alloc = 0;
+   book->old_entry = NULL;
+   book->old_ctrl = NULL;
+   book->old_games = NULL;
+   book->old_group = 0;
+   book->packed = false;
+
+   posting_pool_init(&book->pool);
+}
+
+// book_free()
+
+static void book_free(book_t * book) {
+
+   ASSERT(book!=NULL);
+
+   my_free(book->entry);
+   my_free(book->ctrl);
+   if (book->games != NULL) my_free(book->games);
+   if (book->old_entry != NULL) my_free(book->old_entry);
+   if (book->old_ctrl != NULL) my_free(book->old_ctrl);
+   if (book->old_games != NULL) my_free(book->old_games);
+   posting_pool_free(&book->pool);
+
+   book->entry = NULL;
+   book->ctrl = NULL;
+   book->games = NULL;
+   book->old_entry = NULL;
+   book->old_ctrl = NULL;
+   book->old_games = NULL;
+   book->size = 0;
+   book->alloc = 0;
+   book->old_alloc = 0;
+}
+
+// book_insert()
+
+static void book_insert(const char file_name[], const char leveldb_file_name[]) {
+
+   int game_nb = 0;
+   int chunk_nb = 0;
+   long int start_pos = 0;
+   long int stop_pos;
+   pgn_t pgn[1];
+   pipe_t pipe[1];
+   const batch_t * game_batch;
+   int game;
+   leveldb::WriteBatch batch;
+   std::string tags;
+   int i;
+   stamp_t stamp[1];
+   count_env_t * env;
+
+   leveldb::DB* db = NULL;
+   ASSERT(file_name!=NULL);
+
+   env = NULL;
+
+   if (leveldb_file_name!=NULL) {
+       
+       leveldb::Options options;
+       options.create_if_missing = true;
+
+       if (StatsFile != NULL) {
+          env = new count_env_t();
+          options.env = env;
+       }
+
+       leveldb::Status status = leveldb::DB::Open(options, leveldb_file_name, &db);
+       std::cout << leveldb_file_name<<"\n";        
+       if (!status.ok()) my_fatal("book_insert(): can't open leveldb \"%s\": %s\n",leveldb_file_name,status.ToString().c_str());
+
+       if (Append) {
+
+          // carry on after the games of the previous run
+
+          start_pos = index_read(db,"pgn_offset");
+          game_nb = index_read(db,"next_game_number");
+          chunk_nb = index_read(db,"next_chunk_number");
+          IndexFormat = index_read(db,"index_format");
+          tag_list_set(IndexTags,index_read_string(db,"index_tags").c_str(),"-index-tags");
+
+          printf("appending after game %d, from offset %ld ...\n",game_nb,start_pos);
+       }
+     }
+
+   // scan loop, -pipeline reads and decodes the games on other threads
+
+   game_batch = NULL;
+   game = 0;
+
+   // a game still being written at the end of the file is left for the next -append
+
+   stop_pos = (Append) ? pgn_complete_size(file_name,start_pos) : -1;
+
+   if (Decoders != 0) {
+      pipe_start(pipe,file_name,start_pos,stop_pos,leveldb_file_name!=NULL);
+   } else {
+      pgn_open_range(pgn,file_name,start_pos,stop_pos);
+   }
+
+   stats_start(stamp);
+
+   while ((Decoders != 0) ? pipe_next_game(pipe,&game_batch,&game) : next_game(pgn)) {
+
+      if (Decoders != 0) stats_start(stamp); // waiting for the decoders is not a phase
+
+      // repeated games are dropped before they get a number
+
+      if (Decoders != 0) {
+         if (DedupeMemory != 0 && dedupe_seen(Dedupe,game_batch->hash[game])) {
+            DuplicateNb++;
+            continue;
+         }
+      } else if (!insert_game(Book,pgn,game_nb,stamp)) {
+         DuplicateNb++;
+         continue;
+      }
+
+    if (leveldb_file_name!=NULL) {
+        
+        batch.Put(game_key(game_nb), (Decoders != 0) ? game_batch->value[game] : game_value(pgn));
+        if (batch.ApproximateSize() >= BatchSize) index_write(db,&batch);
+        stats_phase(PHASE_FLUSH,stamp);
+    } 
+
+      if (Decoders != 0) {
+
+         int ply, result;
+
+         result = game_batch->result[game];
+         ply = (game == 0) ? 0 : game_batch->end[game-1];
+
+         stats_game(game_batch->end[game]-ply);
+
+         for (; ply < game_batch->end[game]; ply++) {
+            if (game_batch->ply[ply].illegal) pipe_illegal(pipe,game_batch,ply);
+            insert_move(Book,&game_batch->ply[ply],result,game_nb);
+            result = -result;
+         }
+
+         stats_phase(PHASE_INSERT,stamp);
+      }
+
+      game_nb++;
+      if (game_nb % 10000 == 0) { 
+          stats_progress(Book,game_nb);
+
+      }
+
+      if (game_nb % FlushGames == 0) { 
+          if (leveldb_file_name!=NULL) {
+            printf("\nPutting games into leveldb.."); 
+
+            stats_start(stamp);
+            index_flush(db,&batch,Book,chunk_nb++);
+
+            book_free(Book);
+            book_clear(Book);
+            stats_phase(PHASE_FLUSH,stamp);
+          }
+      }
+   }
+
+   if (Decoders != 0) {
+
+      stop_pos = pipe_stop(pipe);
+
+   } else {
+
+      stop_pos = pgn_tell(pgn);
+      pgn_close(pgn);
+      stats_phase(PHASE_PARSE,stamp); // the end of the file
+   }
+
+   printf("%d game%s.\n", game_nb+1, (game_nb>1)?"s":"");
+   if (leveldb_file_name==NULL) {
+       printf("%d entries.\n", Book->size);
+   }
+   else {        
+        printf("Iterating thru all book positions..");
+
+        stats_start(stamp);
+        if (Book->size != 0) index_flush(db,&batch,Book,chunk_nb++);
+
+        book_free(Book);
+        book_clear(Book);
+
+       batch.Put(char_to_string("total_game_count"), int_to_string(game_nb+1));
+       batch.Put(char_to_string("pgn_filename"), char_to_string(file_name));
+       batch.Put(char_to_string("index_format"), int_to_string(IndexFormat));
+
+       tags.clear();
+
+       for (i = 0; i < int(IndexTags.size()); i++) {
+          if (i > 0) tags += ",";
+          tags += IndexTags[i];
+       }
+
+       batch.Put(char_to_string("index_tags"), tags);
+
+       // where -append resumes
+
+       batch.Put(char_to_string("pgn_offset"), int_to_string(stop_pos));
+       batch.Put(char_to_string("next_game_number"), int_to_string(game_nb));
+       batch.Put(char_to_string("next_chunk_number"), int_to_string(chunk_nb));
+       index_write(db,&batch);
+       delete db;    
+
+       stats_phase(PHASE_FLUSH,stamp); // includes the compactions that delete waits for
+       if (env != NULL) delete env;
+   }
+
+   return;
+}
+
+// index_flush()
+
+static void index_flush(leveldb::DB * db, leveldb::WriteBatch * batch, book_t * book, int chunk_nb) {
+
+   int first, pos;
+
+   ASSERT(db!=NULL);
+   ASSERT(batch!=NULL);
+   ASSERT(book!=NULL);
+   ASSERT(chunk_nb>=0);
+
+   // group the moves of each position
+
+   book_pack(book);
+   entry_sort(book->entry,book->games,book->size,1);
+
+   // one new (position,chunk) record per position, old chunks are never read
+
+   for (first = 0; first < book->size; first = pos) {
+
+      for (pos = first; pos < book->size && book->entry[pos].key == book->entry[first].key; pos++)
+         ;
+
+      batch->Put(position_key(book->entry[first].key,chunk_nb), position_value(book,first,pos));
+      if (batch->ApproximateSize() >= BatchSize) index_write(db,batch);
+   }
+
+   index_write(db,batch);
+}
+
+// index_write()
+
+static void index_write(leveldb::DB * db, leveldb::WriteBatch * batch) {
+
+   leveldb::Status status;
+
+   ASSERT(db!=NULL);
+   ASSERT(batch!=NULL);
+
+   if (StatsFile != NULL) Stats->user_bytes += batch->ApproximateSize(); // main thread only
+
+   status = db->Write(leveldb::WriteOptions(), batch);
+   if (!status.ok()) my_fatal("index_write(): %s\n",status.ToString().c_str());
+
+   batch->Clear();
+}
+
+// index_read()
+
+static long int index_read(leveldb::DB * db, const char key[]) {
+
+   leveldb::Status status;
+   std::string value;
+
+   ASSERT(db!=NULL);
+   ASSERT(key!=NULL);
+
+   status = db->Get(leveldb::ReadOptions(), key, &value);
+
+   if (status.IsNotFound()) {
+      my_fatal("index_read(): no \"%s\" in the index, rebuild it without -append\n",key);
+   } else if (!status.ok()) {
+      my_fatal("index_read(): %s\n",status.ToString().c_str());
+   }
+
+   return atol(value.c_str());
+}
+
+// index_read_string()
+
+static std::string index_read_string(leveldb::DB * db, const char key[]) {
+
+   leveldb::Status status;
+   std::string value;
+
+   ASSERT(db!=NULL);
+   ASSERT(key!=NULL);
+
+   // "" if missing, for keys older indexes don't have
+
+   status = db->Get(leveldb::ReadOptions(), key, &value);
+
+   if (status.IsNotFound()) {
+      value.clear();
+   } else if (!status.ok()) {
+      my_fatal("index_read_string(): %s\n",status.ToString().c_str());
+   }
+
+   return value;
+}
+
+// tag_list_set()
+
+static void tag_list_set(std::vector<std::string> & tags, const char list[], const char option[]) {
+
+   const char * ptr;
+   const char * end;
+   std::string name;
+
+   ASSERT(list!=NULL);
+   ASSERT(option!=NULL);
+
+   // comma-separated tag names, kept in order
+
+   tags.clear();
+
+   for (ptr = list; *ptr != '\0'; ptr = (*end == ',') ? end + 1 : end) {
+
+      end = strchr(ptr,',');
+      if (end == NULL) end = ptr + strlen(ptr);
+
+      name.assign(ptr,end-ptr);
+
+      if (name.empty() || name.find_first_of("|\" []") != std::string::npos) {
+         my_fatal("book_make(): bad tag name \"%s\" in %s\n",name.c_str(),option);
+      }
+
+      tags.push_back(name);
+   }
+}
+
+// game_key()
+
+static std::string game_key(int game_nb) {
+
+   std::string s;
+
+   ASSERT(game_nb>=0);
+
+   if (IndexFormat == IndexFormatBinary) {
+      s += IndexTagGame;
+      put_integer(s,4,game_nb);
+   } else {
+      std::ostringstream os;
+      os << "game_" << game_nb << "_data";
+      s = os.str();
+   }
+
+   return s;
+}
+
+// game_value()
+
+static std::string game_value(const pgn_t * pgn) {
+
+   std::string s;
+   int i;
+   const char * value;
+
+   ASSERT(pgn!=NULL);
+
+   if (IndexFormat == IndexFormatBinary) {
+
+      // length-prefixed fields, in the same order as the text format
+
+      put_string(s,pgn_tag(pgn,TAG_WHITE));
+      put_string(s,pgn_tag(pgn,TAG_WHITE_ELO));
+      put_string(s,pgn_tag(pgn,TAG_BLACK));
+      put_string(s,pgn_tag(pgn,TAG_BLACK_ELO));
+      put_string(s,pgn_tag(pgn,TAG_RESULT));
+      put_string(s,pgn_tag(pgn,TAG_DATE));
+      put_string(s,pgn_tag(pgn,TAG_EVENT));
+      put_string(s,pgn_tag(pgn,TAG_SITE));
+      put_string(s,pgn_tag(pgn,TAG_ECO));
+      put_varint(s,(pgn->last_stream_pos<0)?0:pgn->last_stream_pos);
+      put_string(s,pgn_tag(pgn,TAG_FEN));
+      put_string(s,pgn_tag(pgn,TAG_PLY_COUNT));
+      put_string(s,pgn_tag(pgn,TAG_EVENT_DATE));
+      put_string(s,pgn_tag(pgn,TAG_EVENT_TYPE));
+
+      for (i = 0; i < int(IndexTags.size()); i++) {
+         value = pgn_tag_find(pgn,IndexTags[i].c_str());
+         put_string(s,(value != NULL) ? value : "*");
+      }
+
+   } else {
+
+      std::stringstream game_info;
+      game_info << pgn_tag(pgn,TAG_WHITE);
+      game_info << "|"<< pgn_tag(pgn,TAG_WHITE_ELO);
+      game_info << "|"<< pgn_tag(pgn,TAG_BLACK);
+      game_info << "|"<< pgn_tag(pgn,TAG_BLACK_ELO);
+      game_info << "|"<< pgn_tag(pgn,TAG_RESULT);
+
+      game_info << "|"<< pgn_tag(pgn,TAG_DATE);
+      game_info << "|"<< pgn_tag(pgn,TAG_EVENT);
+      game_info << "|"<< pgn_tag(pgn,TAG_SITE);
+      game_info << "|"<< pgn_tag(pgn,TAG_ECO);
+      game_info << "|"<< pgn->last_stream_pos;
+      game_info << "|"<< pgn_tag(pgn,TAG_FEN);
+
+      game_info << "|"<< pgn_tag(pgn,TAG_PLY_COUNT);
+      game_info << "|"<< pgn_tag(pgn,TAG_EVENT_DATE);
+      game_info << "|"<< pgn_tag(pgn,TAG_EVENT_TYPE);
+
+      for (i = 0; i < int(IndexTags.size()); i++) {
+         value = pgn_tag_find(pgn,IndexTags[i].c_str());
+         game_info << "|" << ((value != NULL) ? value : "*");
+      }
+
+      s = game_info.str();
+   }
+
+   return s;
+}
+
+// position_key()
+
+static std::string position_key(uint64 key, int chunk_nb) {
+
+   std::string s;
+
+   ASSERT(chunk_nb>=0);
+
+   if (IndexFormat == IndexFormatBinary) {
+
+      // big-endian, so that leveldb's key order is the book order
+
+      s += IndexTagPosition;
+      put_integer(s,8,key);
+      put_integer(s,4,chunk_nb);
+
+   } else {
+      std::ostringstream os;
+      os << key << "_" << std::setw(6) << std::setfill('0') << chunk_nb;
+      s = os.str();
+   }
+
+   return s;
+}
+
+// position_value()
+
+static std::string position_value(const book_t * book, int first, int last) {
+
+   std::string s;
+   int pos;
+
+   ASSERT(book!=NULL);
+   ASSERT(first>=0&&first<last&&last<=book->size);
+
+   if (IndexFormat == IndexFormatBinary) {
+
+      // sorted game ids of all the moves, as varint deltas
+
+      std::vector<int> game;
+      posting_iter_t iter[1];
+      int game_nb;
+      int prev;
+      size_t i;
+
+      for (pos = first; pos < last; pos++) {
+         posting_iter_init(iter,&book->pool,&book->games[pos]);
+         while (posting_iter_next(iter,&game_nb)) game.push_back(game_nb);
+      }
+
+      std::sort(game.begin(),game.end());
+
+      prev = 0;
+
+      for (i = 0; i < game.size(); i++) {
+         if (i > 0 && game[i] == prev) continue;
+         put_varint(s,game[i]-prev);
+         prev = game[i];
+      }
+
+   } else {
+
+      std::stringstream game_id_stream;
+
+      for (pos = first; pos < last; pos++) {
+         write_games(game_id_stream, book, pos);
+      }
+
+      s = game_id_stream.str();
+   }
+
+   return s;
+}
+
+// stats_init()
+
+static void stats_init() {
+
+   int phase;
+
+   // -stats-json, the stats_*() functions do nothing without it
+
+   pthread_mutex_init(&Stats->mutex,NULL);
+
+   my_timer_reset(Stats->timer);
+   my_timer_start(Stats->timer);
+
+   Stats->insert_start = now_real();
+
+   for (phase = 0; phase < PHASE_NB; phase++) {
+      Stats->real[phase] = 0.0;
+      Stats->cpu[phase] = 0.0;
+   }
+
+   Stats->game_nb = 0;
+   Stats->ply_nb = 0;
+   Stats->entry_nb = 0;
+   Stats->slot_nb = 0;
+   Stats->probe_nb = 0;
+   Stats->probe_max = 0;
+   Stats->user_bytes = 0;
+   Stats->disk_bytes = 0;
+}
+
+// stats_start()
+
+static void stats_start(stamp_t * stamp) {
+
+   ASSERT(stamp!=NULL);
+
+   if (StatsFile == NULL) return;
+
+   stamp->real = now_real();
+   stamp->cpu = now_thread_cpu();
+}
+
+// stats_phase()
+
+static void stats_phase(int phase, stamp_t * stamp) {
+
+   stamp_t now[1];
+
+   ASSERT(phase>=0&&phase<PHASE_NB);
+   ASSERT(stamp!=NULL);
+
+   if (StatsFile == NULL) return;
+
+   // charge the time since stamp to phase, the next phase starts now
+
+   stats_start(now);
+
+   pthread_mutex_lock(&Stats->mutex);
+   Stats->real[phase] += now->real - stamp->real;
+   Stats->cpu[phase] += now->cpu - stamp->cpu;
+   pthread_mutex_unlock(&Stats->mutex);
+
+   *stamp = *now;
+}
+
+// stats_game()
+
+static void stats_game(int ply_nb) {
+
+   ASSERT(ply_nb>=0);
+
+   if (StatsFile == NULL) return;
+
+   pthread_mutex_lock(&Stats->mutex);
+   Stats->game_nb++;
+   Stats->ply_nb += ply_nb;
+   pthread_mutex_unlock(&Stats->mutex);
+}
+
+// stats_table()
+
+static void stats_table(const book_t * book) {
+
+   int mask;
+   int slot;
+   int probe;
+   sint64 probe_nb;
+   int probe_max;
+
+   ASSERT(book!=NULL);
+   ASSERT(!book->packed);
+   ASSERT(book->old_entry==NULL);
+
+   // distance of each entry from its home group, what table_find() walks to reach it
+
+   mask = book->alloc / GroupSize - 1;
+
+   probe_nb = 0;
+   probe_max = 0;
+
+   for (slot = 0; slot < book->alloc; slot++) {
+
+      if ((book->ctrl[slot] & CtrlEmpty) != 0) continue;
+
+      probe = ((slot / GroupSize - key_group(book->entry[slot].key,mask)) & mask) + 1;
+
+      probe_nb += probe;
+      if (probe > probe_max) probe_max = probe;
+   }
+
+   pthread_mutex_lock(&Stats->mutex);
+   Stats->entry_nb += book->size;
+   Stats->slot_nb += book->alloc;
+   Stats->probe_nb += probe_nb;
+   if (probe_max > Stats->probe_max) Stats->probe_max = probe_max;
+   pthread_mutex_unlock(&Stats->mutex);
+}
+
+// stats_progress()
+
+static void stats_progress(const book_t * book, int game_nb) {
+
+   double elapsed;
+
+   ASSERT(book!=NULL);
+   ASSERT(game_nb>0);
+
+   if (StatsFile == NULL) {
+      printf("%d games ...\n",game_nb);
+      return;
+   }
+
+   // rates since the games started to be inserted
+
+   elapsed = now_real() - Stats->insert_start;
+   if (elapsed <= 0.0) elapsed = 1E-6;
+
+   printf("%d games ... %.0f games/s, %.0f plies/s, %d entries (load %.2f), %.0fMB peak\n",
+          game_nb,double(Stats->game_nb)/elapsed,double(Stats->ply_nb)/elapsed,
+          book->size,double(book->size)/double(book->alloc),peak_memory()/1048576.0);
+}
+
+// stats_save()
+
+static void stats_save(const char file_name[]) {
+
+   FILE * file;
+   double real, cpu;
+   int phase;
+
+   ASSERT(file_name!=NULL);
+
+   my_timer_stop(Stats->timer);
+
+   real = my_timer_elapsed_real(Stats->timer);
+   cpu = my_timer_elapsed_cpu(Stats->timer);
+   if (real <= 0.0) real = 1E-6;
+
+   printf("%.2fs, %.0f games/s, %.0f plies/s, %.0fMB peak.\n",
+          real,double(Stats->game_nb)/real,double(Stats->ply_nb)/real,peak_memory()/1048576.0);
+
+   file = fopen(file_name,"w");
+   if (file == NULL) my_fatal("stats_save(): can't open file \"%s\" for writing: %s\n",file_name,strerror(errno));
+
+   // seconds, bytes and plain counts, phase times are summed over threads
+
+   fprintf(file,"{\n");
+   fprintf(file,"  \"games\": %d,\n",Stats->game_nb);
+   fprintf(file,"  \"duplicates\": %d,\n",DuplicateNb);
+   fprintf(file,"  \"plies\": " S64_FORMAT ",\n",Stats->ply_nb);
+   fprintf(file,"  \"threads\": %d,\n",(Decoders!=0)?Decoders:Threads);
+   fprintf(file,"  \"real\": %.6f,\n",real);
+   fprintf(file,"  \"cpu\": %.6f,\n",cpu);
+   fprintf(file,"  \"games_per_second\": %.1f,\n",double(Stats->game_nb)/real);
+   fprintf(file,"  \"plies_per_second\": %.1f,\n",double(Stats->ply_nb)/real);
+   fprintf(file,"  \"peak_rss_bytes\": %.0f,\n",peak_memory());
+
+   fprintf(file,"  \"phases\": {\n");
+
+   for (phase = 0; phase < PHASE_NB; phase++) {
+      fprintf(file,"    \"%s\": {\"real\": %.6f, \"cpu\": %.6f}%s\n",
+              PhaseName[phase],Stats->real[phase],Stats->cpu[phase],(phase<PHASE_NB-1)?",":"");
+   }
+
+   fprintf(file,"  },\n");
+
+   fprintf(file,"  \"table\": {\"entries\": " S64_FORMAT ", \"slots\": " S64_FORMAT ", \"load_factor\": %.4f, \"probe_length\": %.4f, \"probe_length_max\": %d},\n",
+           Stats->entry_nb,Stats->slot_nb,
+           (Stats->slot_nb!=0)?double(Stats->entry_nb)/double(Stats->slot_nb):0.0,
+           (Stats->entry_nb!=0)?double(Stats->probe_nb)/double(Stats->entry_nb):0.0,
+           Stats->probe_max);
+
+   if (Storage == LEVELDB) {
+      fprintf(file,"  \"leveldb\": {\"user_bytes\": " S64_FORMAT ", \"disk_bytes\": " S64_FORMAT ", \"write_amplification\": %.4f}\n",
+              Stats->user_bytes,Stats->disk_bytes,
+              (Stats->user_bytes!=0)?double(Stats->disk_bytes)/double(Stats->user_bytes):0.0);
+   } else {
+      fprintf(file,"  \"leveldb\": null\n");
+   }
+
+   fprintf(file,"}\n");
+
+   if (fclose(file) == EOF) my_fatal("stats_save(): fclose(): %s\n",strerror(errno));
+
+   pthread_mutex_destroy(&Stats->mutex);
+
+   printf("statistics saved in \"%s\".\n",file_name);
+}
+
+// count_file_t::Append()
+
+leveldb::Status count_file_t::Append(const leveldb::Slice & data) {
+
+   // also called by the leveldb compaction thread
+
+   pthread_mutex_lock(&Stats->mutex);
+   Stats->disk_bytes += data.size();
+   pthread_mutex_unlock(&Stats->mutex);
+
+   return file->Append(data);
+}
+
+// count_env_t::NewWritableFile()
+
+leveldb::Status count_env_t::NewWritableFile(const std::string & name, leveldb::WritableFile * * file) {
+
+   leveldb::Status status;
+
+   ASSERT(file!=NULL);
+
+   // log, table and manifest files
+
+   status = target()->NewWritableFile(name,file);
+   if (status.ok()) *file = new count_file_t(*file);
+
+   return status;
+}
+
+// put_varint()
+
+static void put_varint(std::string & s, uint64 n) {
+
+   while (n >= 0x80) {
+      s += char((n & 0x7F) | 0x80);
+      n >>= 7;
+   }
+
+   s += char(n);
+}
+
+// put_string()
+
+static void put_string(std::string & s, const char string[]) {
+
+   size_t len;
+
+   ASSERT(string!=NULL);
+
+   len = strlen(string);
+
+   put_varint(s,len);
+   s.append(string,len);
+}
+
+// put_integer()
+
+static void put_integer(std::string & s, int size, uint64 n) {
+
+   int i;
+
+   ASSERT(size>0&&size<=8);
+   ASSERT(size==8||n>>(size*8)==0);
+
+   for (i = size-1; i >= 0; i--) {
+      s += char((n >> (i*8)) & 0xFF);
+   }
+}
+
+// pipe_start()
+
+static void pipe_start(pipe_t * pipe, const char file_name[], long int start_pos, long int stop_pos, bool header) {
+
+   int i;
+
+   ASSERT(pipe!=NULL);
+   ASSERT(file_name!=NULL);
+   ASSERT(Decoders>=1&&Decoders<=ThreadMax);
+
+   // a bounded ring of batches: the reader fills them in order, any decoder
+   // converts them to plies, and the table stage takes them back in order so
+   // that the games are numbered and inserted as in a serial build
+
+   pthread_mutex_init(&pipe->mutex,NULL);
+   pthread_cond_init(&pipe->cond,NULL);
+
+   pipe->file_name = file_name;
+   pipe->start_pos = start_pos;
+   pipe->stop_pos = stop_pos; // -1 for the end of the file, then where the reader stopped
+   pipe->header = header;
+   pipe->where_open = false;
+   pipe->eof = false;
+   pipe->read_nb = 0;
+   pipe->decode_nb = 0;
+   pipe->done_nb = 0;
+   pipe->game = 0;
+   pipe->depth = 2 * Decoders + 2;
+   pipe->batch = new batch_t[pipe->depth];
+
+   for (i = 0; i < pipe->depth; i++) {
+      pipe->batch[i].state = 0; // free for the reader
+      pipe->batch[i].game_nb = 0;
+   }
+
+   if (pthread_create(&pipe->reader,NULL,&pipe_reader,pipe) != 0) {
+      my_fatal("pipe_start(): pthread_create(): %s\n",strerror(errno));
+   }
+
+   for (i = 0; i < Decoders; i++) {
+      if (pthread_create(&pipe->decoder[i],NULL,&pipe_decoder,pipe) != 0) {
+         my_fatal("pipe_start(): pthread_create(): %s\n",strerror(errno));
+      }
+   }
+}
+
+// pipe_next_game()
+
+static bool pipe_next_game(pipe_t * pipe, const batch_t * * batch, int * game) {
+
+   batch_t * current;
+
+   ASSERT(pipe!=NULL);
+   ASSERT(batch!=NULL);
+   ASSERT(game!=NULL);
+
+   pthread_mutex_lock(&pipe->mutex);
+
+   while (true) {
+
+      if (pipe->done_nb == pipe->read_nb) {
+
+         // the next slot is not filled yet
+
+         if (pipe->eof) {
+            pthread_mutex_unlock(&pipe->mutex);
+            return false;
+         }
+
+         pthread_cond_wait(&pipe->cond,&pipe->mutex);
+         continue;
+      }
+
+      current = &pipe->batch[pipe->done_nb%pipe->depth];
+
+      if (current->state == 2 && pipe->game < current->game_nb) break;
+
+      if (current->state == 2) {
+
+         // batch consumed, hand the slot back to the reader
+
+         current->state = 0;
+         pipe->done_nb++;
+         pipe->game = 0;
+         pthread_cond_broadcast(&pipe->cond);
+
+      } else {
+         pthread_cond_wait(&pipe->cond,&pipe->mutex);
+      }
+   }
+
+   pthread_mutex_unlock(&pipe->mutex);
+
+   *batch = current;
+   *game = pipe->game++;
+
+   return true;
+}
+
+// pipe_stop()
+
+static long int pipe_stop(pipe_t * pipe) {
+
+   int i;
+
+   ASSERT(pipe!=NULL);
+
+   pthread_join(pipe->reader,NULL);
+
+   for (i = 0; i < Decoders; i++) {
+      pthread_join(pipe->decoder[i],NULL);
+   }
+
+   delete[] pipe->batch;
+
+   if (pipe->where_open) pgn_close(pipe->where);
+
+   pthread_cond_destroy(&pipe->cond);
+   pthread_mutex_destroy(&pipe->mutex);
+
+   return pipe->stop_pos;
+}
+
+// pipe_reader()
+
+static void * pipe_reader(void * arg) {
+
+   pipe_t * pipe;
+   pgn_t pgn[1];
+   batch_t * batch;
+   char string[256];
+   token_t token;
+   int ply;
+   bool eof;
+   stamp_t stamp[1];
+
+   pipe = (pipe_t *) arg;
+   ASSERT(pipe!=NULL);
+
+   pgn_open_range(pgn,pipe->file_name,pipe->start_pos,pipe->stop_pos);
+
+   eof = false;
+
+   while (!eof) {
+
+      // wait for a free slot
+
+      pthread_mutex_lock(&pipe->mutex);
+      while (pipe->read_nb - pipe->done_nb >= pipe->depth) pthread_cond_wait(&pipe->cond,&pipe->mutex);
+      pthread_mutex_unlock(&pipe->mutex);
+
+      stats_start(stamp);
+
+      batch = &pipe->batch[pipe->read_nb%pipe->depth];
+      ASSERT(batch->state==0);
+
+      batch->game_nb = 0;
+      batch->text.clear();
+      batch->token.clear();
+
+      while (batch->game_nb < PipeGames) {
+
+         if (!next_game(pgn)) {
+            eof = true;
+            break;
+         }
+
+         batch->result[batch->game_nb] = game_result(pgn);
+         if (pipe->header) batch->value[batch->game_nb] = game_value(pgn);
+
+         ply = 0;
+
+         while (true) {
+
+            if (ply >= MaxPly) {
+               if (DedupeMemory == 0) pgn_skip_game(pgn);
+               break;
+            }
+
+            if (!pgn_next_move(pgn,string,256)) break;
+
+            token.text = batch->text.size();
+            token.pos = pgn->move_pos;
+
+            batch->text.append(string,strlen(string)+1);
+            batch->token.push_back(token);
+            ply++;
+         }
+
+         // the decoders add the moves to the -dedupe hash
+
+         if (DedupeMemory != 0) batch->hash[batch->game_nb] = game_text(pgn,ply>=MaxPly);
+
+         batch->end[batch->game_nb++] = batch->token.size();
+      }
+
+      if (eof) pipe->stop_pos = pgn_tell(pgn);
+
+      stats_phase(PHASE_PARSE,stamp);
+
+      pthread_mutex_lock(&pipe->mutex);
+      batch->state = 1;
+      pipe->read_nb++;
+      pipe->eof = eof;
+      pthread_cond_broadcast(&pipe->cond);
+      pthread_mutex_unlock(&pipe->mutex);
+   }
+
+   pgn_close(pgn);
+
+   return NULL;
+}
+
+// pipe_decoder()
+
+static void * pipe_decoder(void * arg) {
+
+   pipe_t * pipe;
+   batch_t * batch;
+   stamp_t stamp[1];
+
+   pipe = (pipe_t *) arg;
+   ASSERT(pipe!=NULL);
+
+   while (true) {
+
+      pthread_mutex_lock(&pipe->mutex);
+
+      while (pipe->decode_nb == pipe->read_nb && !pipe->eof) pthread_cond_wait(&pipe->cond,&pipe->mutex);
+
+      if (pipe->decode_nb == pipe->read_nb) {
+         pthread_mutex_unlock(&pipe->mutex);
+         break;
+      }
+
+      batch = &pipe->batch[pipe->decode_nb%pipe->depth];
+      pipe->decode_nb++;
+
+      pthread_mutex_unlock(&pipe->mutex);
+
+      stats_start(stamp);
+      pipe_decode(batch);
+      stats_phase(PHASE_DECODE,stamp);
+
+      pthread_mutex_lock(&pipe->mutex);
+      batch->state = 2;
+      pthread_cond_broadcast(&pipe->cond);
+      pthread_mutex_unlock(&pipe->mutex);
+   }
+
+   return NULL;
+}
+
+// pipe_decode()
+
+static void pipe_decode(batch_t * batch) {
+
+   board_t board[1];
+   const char * string;
+   int game;
+   int pos;
+   int move;
+   uint64 moves;
+
+   ASSERT(batch!=NULL);
+
+   batch->ply.resize(batch->token.size());
+
+   pos = 0;
+
+   for (game = 0; game < batch->game_nb; game++) {
+
+      board_start(board);
+      moves = 0;
+
+      for (; pos < batch->end[game]; pos++) {
+
+         string = &batch->text[batch->token[pos].text];
+         move = move_from_san_legal(string,board);
+
+         batch->ply[pos].illegal = move == MoveNone; // logged in game order
+         if (move == MoveNone) move = move_from_san(string,board); // played anyway, like book_insert()
+
+         batch->ply[pos].key = board->key;
+         batch->ply[pos].move = move;
+         batch->ply[pos].colour = board->turn;
+
+         moves = hash_move(moves,move);
+         move_do(board,move);
+      }
+
+      if (DedupeMemory != 0) batch->hash[game] = game_hash(batch->hash[game],moves);
+   }
+}
+
+// pipe_illegal()
+
+static void pipe_illegal(pipe_t * pipe, const batch_t * batch, int ply) {
+
+   int line, column;
+
+   ASSERT(pipe!=NULL);
+   ASSERT(batch!=NULL);
+   ASSERT(ply>=0&&ply<int(batch->token.size()));
+
+   // the table stage has its own view of the file, it only moves forward
+
+   if (!pipe->where_open) {
+      pgn_open(pipe->where,pipe->file_name);
+      pipe->where_open = true;
+   }
+
+   pgn_line_column(pipe->where,batch->token[ply].pos,&line,&column);
+   my_log("book_insert(): illegal move \"%s\" at line %d, column %d\n",&batch->text[batch->token[ply].text],line,column);
+}
+
+// book_insert_runs()
+
+static void book_insert_runs(const char file_name[], const char bin_file_name[]) {
+
+   long int pos[ThreadMax+1];
+   worker_t worker[ThreadMax];
+   run_t * run;
+   int run_nb;
+   FILE * file;
+   char state_name[4096];
+   char tmp_name[4096];
+   FILE * state_in, * state_out;
+   long int start_pos;
+   int old_game_nb;
+   double budget, slot_bytes;
+   int alloc;
+   const char * * name;
+   int name_nb, spilled_nb;
+   char merge_name[4096];
+   int fan_in, merge_nb;
+   int i, j;
+   int game_nb;
+   int entry_nb;
+   stamp_t stamp[1];
+
+   ASSERT(file_name!=NULL);
+   ASSERT(bin_file_name!=NULL);
+   ASSERT(Threads>=1&&Threads<=ThreadMax);
+
+   RunPrefix = bin_file_name;
+
+   // -append keeps the unfiltered merged table next to the .bin, with its
+   // exact counts, the game count and the PGN offset it covers
+
+   start_pos = 0;
+   old_game_nb = 0;
+   state_in = NULL;
+   state_out = NULL;
+
+   if (Append) {
+
+      sprintf(state_name,"%.4000s.state",bin_file_name);
+      sprintf(tmp_name,"%.4000s.state.tmp",bin_file_name);
+
+      state_in = fopen(state_name,"rb");
+
+      if (state_in != NULL) {
+
+         setvbuf(state_in,NULL,_IOFBF,RunBufferSize);
+
+         if (read_integer(state_in,4) != uint64(StateVersion)) {
+            my_fatal("book_insert_runs(): \"%s\" is not a book state file of this version, remove it and build the book again\n",state_name);
+         }
+
+         old_game_nb = read_integer(state_in,4);
+         start_pos = read_integer(state_in,8);
+
+         printf("appending to %d games, from offset %ld ...\n",old_game_nb,start_pos);
+
+      } else if (errno != ENOENT) {
+         my_fatal("book_insert_runs(): can't open file \"%s\": %s\n",state_name,strerror(errno));
+      }
+   }
+
+   // split the PGN file into game-aligned ranges, one per thread, a game
+   // still being written at the end of the file is left for the next -append
+
+   pgn_split(file_name,start_pos,(Append)?pgn_complete_size(file_name,start_pos):-1,pos,Threads);
+
+   // -max-memory: a thread merges its runs into one once it has as many as
+   // its share of the budget can buffer, and as the open file limit allows
+   // with every thread merging at the same time
+
+   RunFanIn = 0;
+
+   if (MaxMemory != 0) {
+
+      RunFanIn = int(double(MaxMemory) * 1048576.0 / double(Threads) / double(RunBufferSize)) - 1; // and the merged run
+      if (RunFanIn > (file_max() - FileReserve) / Threads - 1) RunFanIn = (file_max() - FileReserve) / Threads - 1;
+      if (RunFanIn > RunMax) RunFanIn = RunMax;
+
+      if (RunFanIn < 2) my_fatal("book_insert_runs(): -max-memory is too small, or too many threads for the open file limit\n");
+   }
+
+   for (i = 0; i < Threads; i++) {
+
+      worker[i].id = i;
+      worker[i].file_name = file_name;
+      worker[i].start_pos = pos[i];
+      worker[i].stop_pos = pos[i+1];
+      worker[i].game_nb = 0;
+      worker[i].run_size = 0;
+      worker[i].run_nb = 0;
+      worker[i].spill_nb = 0;
+      book_clear(worker[i].book);
+
+      if (MaxMemory != 0) {
+
+         // largest table (a power of two, see book_grow()) that fits this
+         // thread's share, together with the half-size one it is drained
+         // from, or with the two radix pairs per entry of a spill's sort,
+         // and with the buffer the spill is written through
+
+         budget = double(MaxMemory) * 1048576.0 / double(Threads) - double(RunBufferSize);
+
+         slot_bytes = 1.5 * double(sizeof(entry_t)+1);
+         if (slot_bytes < double(sizeof(entry_t)+1) + 7.0 / 8.0 * 2.0 * double(sizeof(radix_pair_t))) {
+            slot_bytes = double(sizeof(entry_t)+1) + 7.0 / 8.0 * 2.0 * double(sizeof(radix_pair_t));
+         }
+
+         alloc = GroupSize;
+         while (double(alloc*2) * slot_bytes <= budget) {
+            alloc *= 2;
+         }
+
+         worker[i].run_size = alloc / 8 * 7; // never grows past alloc
+
+         if (worker[i].run_size < 2 * MaxPly) my_fatal("book_insert_runs(): -max-memory is too small\n");
+      }
+
+      if (Threads == 1) {
+         worker_loop(&worker[i]);
+      } else if (pthread_create(&worker[i].thread,NULL,&worker_loop,&worker[i]) != 0) {
+         my_fatal("book_insert_runs(): pthread_create(): %s\n",strerror(errno));
+      }
+   }
+
+   game_nb = 0;
+   run_nb = 0;
+
+   for (i = 0; i < Threads; i++) {
+
+      if (Threads > 1 && pthread_join(worker[i].thread,NULL) != 0) {
+         my_fatal("book_insert_runs(): pthread_join(): %s\n",strerror(errno));
+      }
+
+      if (Threads > 1) printf("thread %d: %d games, %d runs.\n",i,worker[i].game_nb,worker[i].run_nb);
+
+      game_nb += worker[i].game_nb;
+      run_nb += worker[i].run_nb + 1;
+   }
+
+   printf("%d game%s.\n",game_nb,(game_nb>1)?"s":"");
+
+   // the runs of the threads that spilled, their tables are freed and their
+   // share of the budget buffers the final merge; the others kept theirs
+
+   name = (const char * *) my_malloc((run_nb+1)*sizeof(const char *));
+   name_nb = 0;
+   spilled_nb = 0;
+
+   for (i = 0; i < Threads; i++) {
+
+      if (worker[i].run_nb != 0) spilled_nb++;
+
+      for (j = 0; j < worker[i].run_nb; j++) {
+         name[name_nb++] = worker[i].run_name[j];
+         worker[i].run_name[j] = NULL;
+      }
+   }
+
+   if (name_nb != 0) {
+
+      // merge passes until the runs, the state and the two outputs (the .bin
+      // and the state) fit those shares and the open file limit
+
+      fan_in = int(double(MaxMemory) * 1048576.0 / double(Threads) * double(spilled_nb) / double(RunBufferSize)) - 2;
+      if (fan_in > file_max() - FileReserve) fan_in = file_max() - FileReserve;
+      if (state_in != NULL) fan_in--;
+
+      if (fan_in < 2) my_fatal("book_insert_runs(): -max-memory is too small for the final merge\n");
+
+      merge_nb = 0;
+
+      while (name_nb > fan_in) {
+
+         sprintf(merge_name,"%.4000s.run.merge.%d",RunPrefix,merge_nb++);
+
+         printf("merging %d of %d runs ...\n",fan_in,name_nb);
+
+         stats_start(stamp);
+         merge_files(name,fan_in,merge_name);
+         stats_phase(PHASE_MERGE,stamp);
+
+         for (i = 0; i < name_nb - fan_in; i++) name[i] = name[i+fan_in];
+         name_nb -= fan_in;
+
+         name[name_nb] = NULL;
+         my_string_set(&name[name_nb],merge_name);
+         name_nb++;
+      }
+   }
+
+   // merge the runs and the tables left in memory straight into the .bin
+
+   run_nb = name_nb + Threads + 1;
+   run = (run_t *) my_malloc(run_nb*sizeof(run_t));
+   run_nb = 0;
+
+   if (state_in != NULL) {
+      run[run_nb].file = state_in;
+      run[run_nb].book = NULL;
+      run[run_nb].pos = 0;
+      run_nb++;
+   }
+
+   for (i = 0; i < name_nb; i++) {
+
+      run[run_nb].file = fopen(name[i],"rb");
+      if (run[run_nb].file == NULL) my_fatal("book_insert_runs(): can't open file \"%s\": %s\n",name[i],strerror(errno));
+      setvbuf(run[run_nb].file,NULL,_IOFBF,RunBufferSize);
+
+      run[run_nb].book = NULL;
+      run[run_nb].pos = 0;
+      run_nb++;
+   }
+
+   for (i = 0; i < Threads; i++) {
+
+      if (worker[i].run_nb != 0) continue; // spilled to the end
+
+      run[run_nb].file = NULL;
+      run[run_nb].book = worker[i].book;
+      run[run_nb].pos = 0;
+      run_nb++;
+   }
+
+   printf("merging %d run%s ...\n",run_nb,(run_nb>1)?"s":"");
+
+   stats_start(stamp);
+
+   file = fopen(bin_file_name,"wb");
+   if (file == NULL) my_fatal("book_insert_runs(): can't open file \"%s\" for writing: %s\n",bin_file_name,strerror(errno));
+   setvbuf(file,NULL,_IOFBF,RunBufferSize); // within -max-memory, see above
+
+   if (Append) {
+
+      state_out = fopen(tmp_name,"wb");
+      if (state_out == NULL) my_fatal("book_insert_runs(): can't open file \"%s\" for writing: %s\n",tmp_name,strerror(errno));
+      setvbuf(state_out,NULL,_IOFBF,RunBufferSize);
+
+      write_integer(state_out,4,StateVersion);
+      write_integer(state_out,4,old_game_nb+game_nb);
+      write_integer(state_out,8,worker[Threads-1].stop_pos);
+   }
+
+   entry_nb = merge_runs(run,run_nb,file,state_out);
+
+   if (fclose(file) == EOF) my_fatal("book_insert_runs(): fclose(): %s\n",strerror(errno));
+
+   stats_phase(PHASE_MERGE,stamp);
+
+   printf("%d entries.\n",entry_nb);
+
+   if (state_out != NULL) {
+
+      // replace the old state only once the new one is complete
+
+      if (fclose(state_out) == EOF) my_fatal("book_insert_runs(): fclose(): %s\n",strerror(errno));
+
+      if (rename(tmp_name,state_name) != 0) {
+         my_fatal("book_insert_runs(): can't rename \"%s\" to \"%s\": %s\n",tmp_name,state_name,strerror(errno));
+      }
+   }
+
+   // cleanup
+
+   for (i = 0; i < run_nb; i++) {
+      if (run[i].file != NULL) fclose(run[i].file);
+   }
+
+   my_free(run);
+
+   for (i = 0; i < name_nb; i++) {
+      if (remove(name[i]) != 0) my_log("book_insert_runs(): can't remove \"%s\"\n",name[i]);
+      my_string_clear(&name[i]);
+   }
+
+   my_free(name);
+
+   for (i = 0; i < Threads; i++) book_free(worker[i].book);
+}
+
+// worker_loop()
+
+static void * worker_loop(void * arg) {
+
+   worker_t * worker;
+   pgn_t pgn[1];
+   stamp_t stamp[1];
+
+   worker = (worker_t *) arg;
+   ASSERT(worker!=NULL);
+
+   pgn_open_range(pgn,worker->file_name,worker->start_pos,worker->stop_pos);
+
+   stats_start(stamp);
+
+   while (next_game(pgn)) {
+
+      if (!insert_game(worker->book,pgn,worker->game_nb,stamp)) {
+         DuplicateNb++; // -dedupe, single worker
+         continue;
+      }
+
+      worker->game_nb++;
+
+      // spill before the next game can make the table outgrow the budget
+
+      if (worker->run_size != 0 && worker->book->size + MaxPly > worker->run_size) {
+         worker_spill(worker);
+         stats_phase(PHASE_SPILL,stamp);
+      }
+
+      if (Threads == 1 && worker->game_nb % 10000 == 0) {
+         stats_progress(worker->book,worker->game_nb);
+      }
+   }
+
+   if (worker->stop_pos == -1) worker->stop_pos = pgn_tell(pgn); // compressed, see pgn_split()
+
+   pgn_close(pgn);
+   stats_phase(PHASE_PARSE,stamp);
+
+   // once it spilled, the table goes to a run too so that the final merge
+   // only buffers files
+
+   if (worker->run_nb != 0) {
+      worker_spill(worker);
+      stats_phase(PHASE_SPILL,stamp);
+      return NULL;
+   }
+
+   // sort by key and move for the final merge
+
+   book_pack(worker->book);
+   entry_sort(worker->book->entry,NULL,worker->book->size,(Threads==1)?sort_threads():1);
+   stats_phase(PHASE_SORT,stamp);
+
+   return NULL;
+}
+
+// worker_spill()
+
+static void worker_spill(worker_t * worker) {
+
+   char file_name[4096];
+   FILE * file;
+   int pos;
+
+   ASSERT(worker!=NULL);
+   ASSERT(worker->run_nb<RunFanIn);
+
+   sprintf(file_name,"%.4000s.run.%d.%d",RunPrefix,worker->id,worker->spill_nb++);
+
+   book_pack(worker->book);
+   entry_sort(worker->book->entry,NULL,worker->book->size,1); // the other threads are still parsing
+
+   file = fopen(file_name,"wb");
+   if (file == NULL) my_fatal("worker_spill(): can't open file \"%s\" for writing: %s\n",file_name,strerror(errno));
+   setvbuf(file,NULL,_IOFBF,RunBufferSize);
+
+   for (pos = 0; pos < worker->book->size; pos++) {
+      write_record(file,&worker->book->entry[pos]);
+   }
+
+   if (ferror(file)) my_fatal("worker_spill(): fputc(): %s\n",strerror(errno));
+   if (fclose(file) == EOF) my_fatal("worker_spill(): fclose(): %s\n",strerror(errno));
+
+   worker->run_name[worker->run_nb] = NULL;
+   my_string_set(&worker->run_name[worker->run_nb],file_name);
+   worker->run_nb++;
+
+   book_free(worker->book);
+   book_clear(worker->book);
+
+   // the table is freed, its memory buffers the merge of the runs into one
+
+   if (worker->run_nb == RunFanIn) {
+
+      sprintf(file_name,"%.4000s.run.%d.%d",RunPrefix,worker->id,worker->spill_nb++);
+
+      merge_files(worker->run_name,worker->run_nb,file_name);
+
+      worker->run_name[0] = NULL;
+      my_string_set(&worker->run_name[0],file_name);
+      worker->run_nb = 1;
+   }
+}
+
+// merge_files()
+
+static void merge_files(const char * name[], int name_nb, const char out_name[]) {
+
+   run_t * run;
+   FILE * file;
+   int i;
+
+   ASSERT(name!=NULL);
+   ASSERT(name_nb>0);
+   ASSERT(out_name!=NULL);
+
+   // combines the runs into a new one, the counts stay exact, and removes them
+
+   run = (run_t *) my_malloc(name_nb*sizeof(run_t));
+
+   for (i = 0; i < name_nb; i++) {
+
+      run[i].file = fopen(name[i],"rb");
+      if (run[i].file == NULL) my_fatal("merge_files(): can't open file \"%s\": %s\n",name[i],strerror(errno));
+      setvbuf(run[i].file,NULL,_IOFBF,RunBufferSize);
+
+      run[i].book = NULL;
+      run[i].pos = 0;
+   }
+
+   file = fopen(out_name,"wb");
+   if (file == NULL) my_fatal("merge_files(): can't open file \"%s\" for writing: %s\n",out_name,strerror(errno));
+   setvbuf(file,NULL,_IOFBF,RunBufferSize);
+
+   merge_runs(run,name_nb,NULL,file);
+
+   if (ferror(file)) my_fatal("merge_files(): fputc(): %s\n",strerror(errno));
+   if (fclose(file) == EOF) my_fatal("merge_files(): fclose(): %s\n",strerror(errno));
+
+   for (i = 0; i < name_nb; i++) {
+      fclose(run[i].file);
+      if (remove(name[i]) != 0) my_log("merge_files(): can't remove \"%s\"\n",name[i]);
+      my_string_clear(&name[i]);
+   }
+
+   my_free(run);
+}
+
+// merge_runs()
+
+static int merge_runs(run_t run[], int run_nb, FILE * file, FILE * state) {
+
+   run_t * * heap;
+   int size;
+   entry_t move[MoveMax];
+   int move_nb;
+   run_t * top;
+   int kept;
+   int i, j;
+
+   ASSERT(run!=NULL);
+   ASSERT(run_nb>0);
+   ASSERT(file!=NULL||state!=NULL);
+
+   // min-heap of the run heads, ordered by key and move
+
+   heap = (run_t * *) my_malloc(run_nb*sizeof(run_t *));
+   size = 0;
+
+   for (i = 0; i < run_nb; i++) {
+      if (run_next(&run[i])) heap[size++] = &run[i];
+   }
+
+   for (i = size/2-1; i >= 0; i--) heap_down(heap,size,i);
+
+   move_nb = 0;
+   kept = 0;
+
+   while (size != 0) {
+
+      top = heap[0];
+
+      if (move_nb > 0 && top->entry->key != move[0].key) {
+         merge_position(move,move_nb,file,state,&kept);
+         move_nb = 0;
+      }
+
+      // combine the same (key,move) across runs, the counts are exact
+
+      if (move_nb == 0 || top->entry->move != move[move_nb-1].move) {
+
+         if (move_nb >= MoveMax) my_fatal("merge_runs(): too many moves\n");
+
+         move[move_nb++] = *top->entry;
+
+      } else {
+
+         j = move_nb - 1;
+
+         move[j].n += top->entry->n;
+         move[j].sum += top->entry->sum;
+      }
+
+      if (!run_next(top)) heap[0] = heap[--size];
+      heap_down(heap,size,0);
+   }
+
+   if (move_nb > 0) merge_position(move,move_nb,file,state,&kept);
+
+   my_free(heap);
+
+   return kept;
+}
+
+// merge_position()
+
+static void merge_position(entry_t move[], int move_nb, FILE * file, FILE * state, int * kept) {
+
+   int src, dst;
+   int j;
+
+   ASSERT(move!=NULL);
+   ASSERT(move_nb>0&&move_nb<=MoveMax);
+   ASSERT(file!=NULL||state!=NULL);
+   ASSERT(kept!=NULL);
+
+   // unfiltered and exact, in key and move order, for the next -append or
+   // for a run merged from others (without a .bin)
+
+   if (state != NULL) {
+      for (j = 0; j < move_nb; j++) write_record(state,&move[j]);
+   }
+
+   if (file == NULL) return;
+
+   rescale_position(move,move_nb);
+
+   // filter, then sort by score
+
+   dst = 0;
+
+   for (src = 0; src < move_nb; src++) {
+      if (keep_entry(&move[src])) move[dst++] = move[src];
+   }
+
+   qsort(move,dst,sizeof(entry_t),&key_compare);
+
+   for (j = 0; j < dst; j++) {
+      write_integer(file, 8, move[j].key);
+      write_integer(file, 2, move[j].move);
+      write_integer(file, 2, entry_score(&move[j]));
+      write_integer(file, 2, 0);
+      write_integer(file, 2, 0);
+   }
+
+   *kept += dst;
+}
+
+// rescale_position()
+
+static void rescale_position(entry_t move[], int move_nb) {
+
+   uint32 n_max;
+   int j;
+
+   ASSERT(move!=NULL);
+   ASSERT(move_nb>0&&move_nb<=MoveMax);
+
+   // the moves of a position are halved together until they fit the book,
+   // once and from the exact totals, so that the order the games were
+   // counted in (threads, runs, -append) doesn't matter
+
+   n_max = 0;
+   for (j = 0; j < move_nb; j++) {
+      if (move[j].n > n_max) n_max = move[j].n;
+   }
+
+   while (n_max >= uint32(COUNT_MAX)) {
+      for (j = 0; j < move_nb; j++) {
+         move[j].n = (move[j].n + 1) / 2;
+         move[j].sum = (move[j].sum + 1) / 2;
+      }
+      n_max = (n_max + 1) / 2;
+   }
+}
+
+// run_next()
+
+static bool run_next(run_t * run) {
+
+   ASSERT(run!=NULL);
+
+   if (run->file != NULL) {
+
+      if (!read_record(run->file,run->entry)) return false;
+
+   } else {
+
+      ASSERT(run->book!=NULL);
+
+      if (run->pos >= run->book->size) return false;
+      *run->entry = run->book->entry[run->pos++];
+   }
+
+   return true;
+}
+
+// heap_down()
+
+static void heap_down(run_t * heap[], int size, int i) {
+
+   int child;
+   run_t * tmp;
+
+   ASSERT(heap!=NULL);
+
+   while (true) {
+
+      child = 2*i + 1;
+      if (child >= size) break;
+
+      if (child+1 < size && move_compare(heap[child+1]->entry,heap[child]->entry) < 0) child++;
+      if (move_compare(heap[child]->entry,heap[i]->entry) >= 0) break;
+
+      tmp = heap[i];
+      heap[i] = heap[child];
+      heap[child] = tmp;
+
+      i = child;
+   }
+}
+
+// book_count()
+
+static void book_count(const char file_name[]) {
+
+   long int pos[ThreadMax+1];
+   worker_t worker[ThreadMax];
+   int i;
+
+   ASSERT(file_name!=NULL);
+   ASSERT(SketchMemory>0);
+
+   // first pass, only fills the sketch that insert_game() checks
+
+   sketch_init(Sketch,SketchMemory);
+
+   pgn_split(file_name,0,-1,pos,Threads);
+
+   for (i = 0; i < Threads; i++) {
+
+      worker[i].id = i;
+      worker[i].file_name = file_name;
+      worker[i].start_pos = pos[i];
+      worker[i].stop_pos = pos[i+1];
+      worker[i].game_nb = 0;
+
+      if (Threads == 1) {
+         count_loop(&worker[i]);
+      } else if (pthread_create(&worker[i].thread,NULL,&count_loop,&worker[i]) != 0) {
+         my_fatal("book_count(): pthread_create(): %s\n",strerror(errno));
+      }
+   }
+
+   for (i = 0; i < Threads; i++) {
+      if (Threads > 1 && pthread_join(worker[i].thread,NULL) != 0) {
+         my_fatal("book_count(): pthread_join(): %s\n",strerror(errno));
+      }
+   }
+}
+
+// count_loop()
+
+static void * count_loop(void * arg) {
+
+   worker_t * worker;
+   pgn_t pgn[1];
+   stamp_t stamp[1];
+
+   worker = (worker_t *) arg;
+   ASSERT(worker!=NULL);
+
+   stats_start(stamp);
+
+   pgn_open_range(pgn,worker->file_name,worker->start_pos,worker->stop_pos);
+
+   while (next_game(pgn)) {
+
+      count_game(pgn);
+      worker->game_nb++;
+
+      if (Threads == 1 && worker->game_nb % 10000 == 0) {
+         printf("%d games ...\n",worker->game_nb);
+      }
+   }
+
+   pgn_close(pgn);
+
+   stats_phase(PHASE_COUNT,stamp);
+
+   return NULL;
+}
+
+// count_game()
+
+static void count_game(pgn_t * pgn) {
+
+   board_t board[1];
+   int ply;
+   char string[256];
+   int move;
+
+   ASSERT(pgn!=NULL);
+
+   board_start(board);
+   ply = 0;
+
+   while (true) {
+
+      if (ply >= MaxPly) {
+         pgn_skip_game(pgn);
+         break;
+      }
+
+      if (!pgn_next_move(pgn,string,256)) break;
+
+      move = move_from_san_legal(string,board);
+      if (move == MoveNone) move = move_from_san(string,board); // reported and played anyway by insert_game()
+
+      sketch_add(Sketch,board->key,move);
+
+      move_do(board,move);
+      ply++;
+   }
+}
+
+// next_game()
+
+static bool next_game(pgn_t * pgn) {
+
+   ASSERT(pgn!=NULL);
+
+   // games rejected by the header filters are skipped without decoding
+   // their moves, and are not numbered
+
+   while (pgn_next_game(pgn)) {
+      if (game_match(pgn)) return true;
+      pgn_skip_game(pgn);
+   }
+
+   return false;
+}
+
+// game_match()
+
+static bool game_match(const pgn_t * pgn) {
+
+   int size;
+
+   ASSERT(pgn!=NULL);
+
+   // missing Elos and dates never match
+
+   if (MinElo != 0) {
+      if (atoi(pgn_tag(pgn,TAG_WHITE_ELO)) < MinElo || atoi(pgn_tag(pgn,TAG_BLACK_ELO)) < MinElo) return false;
+   }
+
+   // dates are compared on the length of the bound, "2010" includes the whole year
+
+   if (DateFrom != NULL) {
+      size = strlen(DateFrom);
+      if (!date_known(pgn_tag(pgn,TAG_DATE),size) || strncmp(pgn_tag(pgn,TAG_DATE),DateFrom,size) < 0) return false;
+   }
+
+   if (DateTo != NULL) {
+      size = strlen(DateTo);
+      if (!date_known(pgn_tag(pgn,TAG_DATE),size) || strncmp(pgn_tag(pgn,TAG_DATE),DateTo,size) > 0) return false;
+   }
+
+   if (EventType != NULL && !my_string_case_equal(pgn_tag(pgn,TAG_EVENT_TYPE),EventType)) return false;
+
+   if (GameResult != NULL && !my_string_equal(pgn_tag(pgn,TAG_RESULT),GameResult)) return false;
+
+   return true;
+}
+
+// date_known()
+
+static bool date_known(const char date[], int size) {
+
+   int i;
+
+   ASSERT(date!=NULL);
+   ASSERT(size>0);
+
+   // the first size characters hold digits and dots, no '?'
+
+   for (i = 0; i < size; i++) {
+      if (!isdigit((unsigned char) date[i]) && date[i] != '.') return false; // also stops at '\0'
+   }
+
+   return true;
+}
+
+// date_valid()
+
+static bool date_valid(const char date[]) {
+
+   int size, i;
+
+   ASSERT(date!=NULL);
+
+   // YYYY, YYYY.MM or YYYY.MM.DD
+
+   size = strlen(date);
+   if (size != 4 && size != 7 && size != 10) return false;
+
+   for (i = 0; i < size; i++) {
+      if (i == 4 || i == 7) {
+         if (date[i] != '.') return false;
+      } else {
+         if (!isdigit((unsigned char) date[i])) return false;
+      }
+   }
+
+   return true;
+}
+
+// insert_game()
+
+static bool insert_game(book_t * book, pgn_t * pgn, int game_nb, stamp_t * stamp) {
+
+   board_t board[1];
+   int ply;
+   int result;
+   char string[256];
+   int move;
+   int line, column;
+   token_t entry;
+   std::string text; // NUL-terminated SAN moves
+   std::vector<token_t> token;
+   std::vector<ply_t> game;
+   uint64 hash, moves;
+
+   ASSERT(book!=NULL);
+   ASSERT(pgn!=NULL);
+   ASSERT(stamp!=NULL);
+
+   if (StatsFile == NULL) return stream_game(book,pgn,game_nb);
+
+   // the moves are read, decoded and inserted in turn, like in a -pipeline
+   // build, so that -stats-json can time each stage once per game
+
+   text.reserve(2048);
+   token.reserve(256);
+
+   while (true) {
+
+      // the rest of the game is not needed, but for -dedupe
+
+      if (int(token.size()) >= MaxPly) {
+         if (DedupeMemory == 0) pgn_skip_game(pgn);
+         break;
+      }
+
+      if (!pgn_next_move(pgn,string,256)) break;
+
+      entry.text = text.size();
+      entry.pos = pgn->move_pos;
+
+      text.append(string,strlen(string)+1);
+      token.push_back(entry);
+   }
+
+   hash = (DedupeMemory != 0) ? game_text(pgn,int(token.size())>=MaxPly) : 0;
+
+   stats_phase(PHASE_PARSE,stamp);
+
+   board_start(board);
+   game.resize(token.size());
+   moves = 0;
+
+   for (ply = 0; ply < int(token.size()); ply++) {
+
+      move = move_from_san_legal(&text[token[ply].text],board);
+
+      if (move == MoveNone) {
+         pgn_line_column(pgn,token[ply].pos,&line,&column);
+         my_log("book_insert(): illegal move \"%s\" at line %d, column %d\n",&text[token[ply].text],line,column);
+         move = move_from_san(&text[token[ply].text],board); // still inserted and played
+      }
+
+      game[ply].key = board->key;
+      game[ply].move = move;
+      game[ply].colour = board->turn;
+      game[ply].illegal = false;
+
+      moves = hash_move(moves,move);
+      move_do(board,move);
+   }
+
+   stats_phase(PHASE_DECODE,stamp);
+
+   if (DedupeMemory != 0 && dedupe_seen(Dedupe,game_hash(hash,moves))) return false;
+
+   result = game_result(pgn);
+
+   for (ply = 0; ply < int(game.size()); ply++) {
+      insert_move(book,&game[ply],result,game_nb);
+      result = -result;
+   }
+
+   stats_phase(PHASE_INSERT,stamp);
+   stats_game(game.size());
+
+   return true;
+}
+
+// stream_game()
+
+static bool stream_game(book_t * book, pgn_t * pgn, int game_nb) {
+
+   board_t board[1];
+   int ply;
+   int result;
+   char string[256];
+   int move;
+   int line, column;
+   ply_t entry;
+   std::vector<ply_t> game; // -dedupe inserts the moves once the whole game is read
+   uint64 moves;
+   int i;
+
+   ASSERT(book!=NULL);
+   ASSERT(pgn!=NULL);
+
+   // each move is inserted as soon as it is decoded, nothing is copied
+
+   board_start(board);
+   ply = 0;
+   result = game_result(pgn);
+   moves = 0;
+
+   while (true) {
+
+      // the rest of the game is not needed, but for -dedupe
+
+      if (ply >= MaxPly) {
+         if (DedupeMemory == 0) pgn_skip_game(pgn);
+         break;
+      }
+
+      if (!pgn_next_move(pgn,string,256)) break;
+
+      move = move_from_san_legal(string,board);
+
+      if (move == MoveNone) {
+         pgn_line_column(pgn,pgn->move_pos,&line,&column);
+         my_log("book_insert(): illegal move \"%s\" at line %d, column %d\n",string,line,column);
+         move = move_from_san(string,board); // still inserted and played
+      }
+
+      entry.key = board->key;
+      entry.move = move;
+      entry.colour = board->turn;
+      entry.illegal = false;
+
+      if (DedupeMemory != 0) {
+         game.push_back(entry);
+         moves = hash_move(moves,move);
+      } else {
+         insert_move(book,&entry,result,game_nb);
+         result = -result;
+      }
+
+      move_do(board,move);
+      ply++;
+   }
+
+   if (DedupeMemory != 0) {
+
+      if (dedupe_seen(Dedupe,game_hash(game_text(pgn,ply>=MaxPly),moves))) return false;
+
+      for (i = 0; i < int(game.size()); i++) {
+         insert_move(book,&game[i],result,game_nb);
+         result = -result;
+      }
+   }
+
+   return true;
+}
+
+// insert_move()
+
+static void insert_move(book_t * book, const ply_t * ply, int result, int game_nb) {
+
+   entry_t * entry;
+   int count;
+
+   ASSERT(book!=NULL);
+   ASSERT(ply!=NULL);
+   ASSERT(result>=-1&&result<=+1);
+
+   // skip moves seen fewer than MinGame times in the first pass, keep_entry() would drop them
+
+   count = (SketchMemory != 0) ? sketch_count(Sketch,ply->key,ply->move) : SketchCountMax;
+   if (count < MinGame && count < SketchCountMax) return;
+
+   entry = find_entry(book,ply->key,ply->move,ply->colour);
+
+   entry->n++;
+   entry->sum += result+1;
+   if (book->games != NULL) posting_add(&book->pool,entry_games(book,entry),game_nb);
+}
+
+// game_result()
+
+static int game_result(const pgn_t * pgn) {
+
+   ASSERT(pgn!=NULL);
+
+   if (false) {
+   } else if (my_string_equal(pgn_tag(pgn,TAG_RESULT),"1-0")) {
+      return +1;
+   } else if (my_string_equal(pgn_tag(pgn,TAG_RESULT),"0-1")) {
+      return -1;
+   }
+
+   return 0;
+}
+
+// game_text()
+
+static uint64 game_text(pgn_t * pgn, bool tail) {
+
+   uint64 hash;
+   const char * value;
+   char string[256];
+   int length;
+   int i;
+
+   ASSERT(pgn!=NULL);
+
+   // the part of the -dedupe hash that is not decoded moves: start
+   // position, -dedupe-tags and, with tail, the SAN moves after -max-ply
+
+   hash = U64(0xCBF29CE484222325);
+
+   value = pgn_tag(pgn,TAG_FEN);
+   hash = hash_string(hash,value,strlen(value));
+
+   for (i = 0; i < int(DedupeTags.size()); i++) {
+      value = pgn_tag_find(pgn,DedupeTags[i].c_str());
+      if (value == NULL) value = "*";
+      hash = hash_string(hash,value,strlen(value));
+   }
+
+   if (tail) {
+
+      while (pgn_next_move(pgn,string,256)) {
+
+         // check marks are not always written
+
+         length = strlen(string);
+         if (length > 0 && (string[length-1] == '+' || string[length-1] == '#')) length--;
+
+         hash = hash_string(hash,string,length);
+      }
+   }
+
+   return hash;
+}
+
+// game_hash()
+
+static uint64 game_hash(uint64 text, uint64 moves) {
+
+   uint64 hash;
+
+   hash = text ^ (moves * U64(0x9E3779B97F4A7C15));
+   hash ^= hash >> 31;
+
+   return hash * U64(0xBF58476D1CE4E5B9);
+}
+
+// hash_string()
+
+static uint64 hash_string(uint64 hash, const char string[], int length) {
+
+   int i;
+
+   ASSERT(string!=NULL);
+   ASSERT(length>=0);
+
+   // FNV-1a, with a NUL after the string to separate it from the next one
+
+   for (i = 0; i < length; i++) {
+      hash = (hash ^ (unsigned char) string[i]) * U64(0x100000001B3);
+   }
+
+   return hash * U64(0x100000001B3);
+}
+
+// hash_move()
+
+static uint64 hash_move(uint64 hash, int move) {
+
+   hash = (hash ^ uint64(move)) * U64(0x9E3779B97F4A7C15);
+
+   return hash ^ (hash >> 29);
+}
+
+// book_sort()
+
+static void book_sort() {
+
+   // in key and move order, the order of the runs book_save() merges
 
-   size = 0;
-   size += Book->alloc * sizeof(entry_t);
-   size += (Book->alloc*2) * sizeof(sint32);
+   book_pack(Book);
+   entry_sort(Book->entry,Book->games,Book->size,sort_threads());
+}
+
+// entry_sort()
+
+static void entry_sort(entry_t entry[], posting_t games[], int size, int threads) {
+
+   radix_pair_t * pair;
+   entry_t tmp;
+   posting_t tmp_games;
+   int pos;
+   int src, dst;
+
+   ASSERT(entry!=NULL||size==0);
+   ASSERT(size>=0);
+   ASSERT(threads>=1);
 
-   if (size >= 1048576) printf("allocating %gMB ...\n",double(size)/1048576.0);
+   // by key then move, in move_compare() order
 
-   // resize arrays
+   if (size < 2) return;
 
-   Book->entry = (entry_t *) my_realloc(Book->entry,Book->alloc*sizeof(entry_t));
-   Book->hash = (sint32 *) my_realloc(Book->hash,(Book->alloc*2)*sizeof(sint32));
+   pair = (radix_pair_t *) my_malloc(size*sizeof(radix_pair_t));
 
-   // rebuild hash table
+   for (pos = 0; pos < size; pos++) {
 
-   for (index = 0; index < Book->alloc*2; index++) {
-      Book->hash[index] = NIL;
+      pair[pos].key = entry[pos].key;
+      pair[pos].low = entry[pos].move;
+      pair[pos].index = pos;
    }
 
-   for (pos = 0; pos < Book->size; pos++) {
+   radix_sort(pair,size,threads);
 
-      for (index = Book->entry[pos].key & Book->mask; Book->hash[index] != NIL; index = (index+1) & Book->mask)
-         ;
+   // permute the entries (and their games) in place, one cycle at a time,
+   // a done slot is its own source
+
+   for (pos = 0; pos < size; pos++) {
+
+      if (int(pair[pos].index) == pos) continue;
+
+      tmp = entry[pos];
+      if (games != NULL) tmp_games = games[pos];
 
-      ASSERT(index>=0&&index<Book->alloc*2);
-      Book->hash[index] = pos;
+      for (dst = pos; (src = int(pair[dst].index)) != pos; dst = src) {
+         entry[dst] = entry[src];
+         if (games != NULL) games[dst] = games[src];
+         pair[dst].index = dst;
+      }
+
+      entry[dst] = tmp;
+      if (games != NULL) games[dst] = tmp_games;
+      pair[dst].index = dst;
    }
+
+   my_free(pair);
 }
 
-// halve_stats()
+// sort_threads()
 
-static void halve_stats(uint64 key) {
+static int sort_threads() {
 
-   int index;
-   int pos;
+   int threads;
+
+   // the final sort runs once the games are read, the whole machine is free by then
+
+   threads = cpu_nb();
+   if (threads < ((Decoders != 0) ? Decoders : Threads)) threads = (Decoders != 0) ? Decoders : Threads;
+
+   return threads;
+}
+
+// book_save()
+
+static void book_save(const char file_name[]) {
+
+   FILE * file;
+   run_t run[1];
+   int entry_nb;
+
+   ASSERT(file_name!=NULL);
+   ASSERT(Book->packed);
+
+   file = fopen(file_name,"wb");
+   if (file == NULL) my_fatal("book_save(): can't open file \"%s\" for writing: %s\n",file_name,strerror(errno));
+   setvbuf(file,NULL,_IOFBF,FileBufferSize);
+
+   // the table is the only run, rescaled and filtered like a -threads build
+
+   run->file = NULL;
+   run->book = Book;
+   run->pos = 0;
+
+   entry_nb = merge_runs(run,1,file,NULL);
+
+   if (fclose(file) == EOF) my_fatal("book_save(): fclose(): %s\n",strerror(errno));
+
+   printf("%d entries.\n",entry_nb);
+}
+
+// find_entry()
+
+static entry_t * find_entry(book_t * book, uint64 key, int move, int colour) {
+
+   int slot;
+   entry_t * entry;
+
+   ASSERT(book!=NULL);
+   ASSERT(!book->packed);
+   ASSERT(move_is_ok(move));
+   ASSERT(colour_is_ok(colour));
+
+   // move a few groups of the previous table, if it is still being drained
+
+   if (book->old_entry != NULL) book_migrate(book,MigrateGroups);
 
    // search
 
-   for (index = key & Book->mask; (pos=Book->hash[index]) != NIL; index = (index+1) & Book->mask) {
+   slot = table_find(book->entry,book->ctrl,book->alloc,key,move);
+   if (slot >= 0) return &book->entry[slot]; // found
+
+   if (book->old_entry != NULL) {
+      slot = table_find(book->old_entry,book->old_ctrl,book->old_alloc,key,move);
+      if (slot >= 0) return &book->old_entry[slot]; // found
+   }
+
+   // not found
+
+   if (book->size + 1 > book->alloc / 8 * 7) book_grow(book);
+
+   // create a new entry
+
+   slot = table_slot(book->ctrl,book->alloc,key);
+   book->ctrl[slot] = key_tag(key);
+   book->size++;
+
+   entry = &book->entry[slot];
+
+   entry->key = key;
+   entry->move = move;
+   entry->n = 0;
+   entry->sum = 0;
+   entry->colour = colour;
+
+   if (book->games != NULL) posting_clear(&book->games[slot]);
+
+   return entry;
+}
+
+// book_grow()
+
+static void book_grow(book_t * book) {
+
+   double size;
+   int slot;
+
+   ASSERT(book!=NULL);
+   ASSERT(!book->packed);
+
+   // at most one table is drained at a time
+
+   if (book->old_entry != NULL) book_migrate(book,book->old_alloc/GroupSize);
+   ASSERT(book->old_entry==NULL);
+
+   book->old_alloc = book->alloc;
+   book->old_entry = book->entry;
+   book->old_ctrl = book->ctrl;
+   book->old_games = book->games;
+   book->old_group = 0;
+
+   book->alloc *= 2;
+
+   size = double(book->alloc) * double(slot_bytes(book));
+   if (size >= 1048576.0) printf("allocating %gMB ...\n",size/1048576.0);
+
+   book->entry = (entry_t *) my_malloc(book->alloc*sizeof(entry_t));
+   book->ctrl = (uint8 *) my_malloc(book->alloc);
+   if (book->old_games != NULL) book->games = (posting_t *) my_malloc(book->alloc*sizeof(posting_t));
+
+   for (slot = 0; slot < book->alloc; slot++) {
+      book->ctrl[slot] = CtrlEmpty;
+   }
+}
+
+// book_migrate()
+
+static void book_migrate(book_t * book, int group_nb) {
+
+   int slot, end;
+   int dst;
+
+   ASSERT(book!=NULL);
+   ASSERT(group_nb>0);
+
+   for (; group_nb > 0 && book->old_entry != NULL; group_nb--) {
+
+      end = (book->old_group + 1) * GroupSize;
+
+      for (slot = book->old_group * GroupSize; slot < end; slot++) {
+
+         if (book->old_ctrl[slot] & CtrlEmpty) continue; // empty or already moved
+
+         dst = table_slot(book->ctrl,book->alloc,book->old_entry[slot].key);
+
+         book->ctrl[dst] = book->old_ctrl[slot];
+         book->entry[dst] = book->old_entry[slot];
+         if (book->games != NULL) book->games[dst] = book->old_games[slot];
+
+         book->old_ctrl[slot] = CtrlMoved; // keeps the old probe sequences going
+      }
+
+      book->old_group++;
+
+      if (book->old_group * GroupSize == book->old_alloc) {
+
+         my_free(book->old_entry);
+         my_free(book->old_ctrl);
+         if (book->old_games != NULL) my_free(book->old_games);
+
+         book->old_entry = NULL;
+         book->old_ctrl = NULL;
+         book->old_games = NULL;
+         book->old_alloc = 0;
+         book->old_group = 0;
+      }
+   }
+}
+
+// book_pack()
+
+static void book_pack(book_t * book) {
+
+   int slot;
+   int dst;
+
+   ASSERT(book!=NULL);
+
+   if (book->packed) return;
+
+   // entry[0..size) becomes a plain array, find_entry() can't be used anymore
+
+   if (book->old_entry != NULL) book_migrate(book,book->old_alloc/GroupSize);
+
+   if (StatsFile != NULL) stats_table(book);
+
+   dst = 0;
+
+   for (slot = 0; slot < book->alloc; slot++) {
+      if ((book->ctrl[slot] & CtrlEmpty) == 0) {
+         if (book->games != NULL) book->games[dst] = book->games[slot];
+         book->entry[dst++] = book->entry[slot];
+      }
+   }
+
+   ASSERT(dst==book->size);
+
+   book->packed = true;
+}
+
+// book_bytes()
+
+static double book_bytes(const book_t * book) {
+
+   ASSERT(book!=NULL);
+
+   return double(book->alloc + book->old_alloc) * double(slot_bytes(book));
+}
+
+// slot_bytes()
+
+static int slot_bytes(const book_t * book) {
+
+   ASSERT(book!=NULL);
+
+   return int(sizeof(entry_t)) + 1 + ((book->games != NULL) ? int(sizeof(posting_t)) : 0);
+}
+
+// entry_games()
+
+static posting_t * entry_games(book_t * book, const entry_t * entry) {
+
+   ASSERT(book!=NULL);
+   ASSERT(book->games!=NULL);
+   ASSERT(entry!=NULL);
+
+   // find_entry() can return a slot of the table being drained
+
+   if (entry >= book->entry && entry < book->entry + book->alloc) {
+      return &book->games[entry-book->entry];
+   }
+
+   ASSERT(book->old_entry!=NULL);
+   ASSERT(entry>=book->old_entry&&entry<book->old_entry+book->old_alloc);
+
+   return &book->old_games[entry-book->old_entry];
+}
+
+// table_find()
+
+static int table_find(const entry_t entry[], const uint8 ctrl[], int alloc, uint64 key, int move) {
+
+   int group, mask;
+   int tag;
+   int slot;
+   uint32 bits;
+
+   ASSERT(entry!=NULL);
+   ASSERT(ctrl!=NULL);
+   ASSERT(alloc>=GroupSize);
+
+   // the inline tags filter the slots, a group with an empty slot ends the search
+
+   mask = alloc / GroupSize - 1;
+   tag = key_tag(key);
 
-      ASSERT(pos>=0&&pos<Book->size);
+   for (group = key_group(key,mask); true; group = (group + 1) & mask) {
 
-      if (Book->entry[pos].key == key) {
-         Book->entry[pos].n = (Book->entry[pos].n + 1) / 2;
-         Book->entry[pos].sum = (Book->entry[pos].sum + 1) / 2;
+      for (bits = group_match(&ctrl[group*GroupSize],tag); bits != 0; bits &= bits - 1) {
+         slot = group * GroupSize + first_bit(bits);
+         if (entry[slot].key == key && entry[slot].move == move) return slot;
       }
+
+      if (group_match(&ctrl[group*GroupSize],CtrlEmpty) != 0) return -1;
+   }
+}
+
+// table_slot()
+
+static int table_slot(const uint8 ctrl[], int alloc, uint64 key) {
+
+   int group, mask;
+   uint32 bits;
+
+   ASSERT(ctrl!=NULL);
+   ASSERT(alloc>=GroupSize);
+
+   // first empty slot of the probe sequence, there is always one (see find_entry())
+
+   mask = alloc / GroupSize - 1;
+
+   for (group = key_group(key,mask); true; group = (group + 1) & mask) {
+      bits = group_match(&ctrl[group*GroupSize],CtrlEmpty);
+      if (bits != 0) return group * GroupSize + first_bit(bits);
+   }
+}
+
+// group_match()
+
+static uint32 group_match(const uint8 ctrl[], int tag) {
+
+   ASSERT(ctrl!=NULL);
+   ASSERT(tag>=0&&tag<256);
+
+#if defined(__SSE2__)
+
+   __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+   return uint32(_mm_movemask_epi8(_mm_cmpeq_epi8(group,_mm_set1_epi8(char(tag)))));
+
+#else
+
+   uint32 bits;
+   int i;
+
+   bits = 0;
+
+   for (i = 0; i < GroupSize; i++) {
+      if (ctrl[i] == tag) bits |= uint32(1) << i;
    }
+
+   return bits;
+
+#endif
+}
+
+// first_bit()
+
+static int first_bit(uint32 bits) {
+
+   ASSERT(bits!=0);
+
+#if defined(__GNUC__)
+   return __builtin_ctz(bits);
+#else
+   int i;
+   for (i = 0; (bits & 1) == 0; i++) bits >>= 1;
+   return i;
+#endif
+}
+
+// key_tag()
+
+static int key_tag(uint64 key) {
+
+   return int(key & 0x7F); // high bit clear, unlike CtrlEmpty and CtrlMoved
+}
+
+// key_group()
+
+static int key_group(uint64 key, int mask) {
+
+   return int((key >> 7) & uint64(mask));
 }
 
 // keep_entry()
 
-static bool keep_entry(int pos) {
+static bool keep_entry(const entry_t * entry) {
 
-   const entry_t * entry;
    int colour;
    double score;
 
-   ASSERT(pos>=0&&pos<Book->size);
-
-   entry = &Book->entry[pos];
+   ASSERT(entry!=NULL);
 
    // if (entry->n == 0) return false;
-   if (entry->n < MinGame) return false;
+   if (int(entry->n) < MinGame) return false;
 
    if (entry->sum == 0) return false;
 
@@ -738,9 +3650,64 @@ static int key_compare(const void * p1, const void * p2) {
       return +1;
    } else if (entry_1->key < entry_2->key) {
       return -1;
-   } else {
+   } else if (entry_score(entry_1) != entry_score(entry_2)) {
       return entry_score(entry_2) - entry_score(entry_1); // highest score first
+   } else {
+      return int(entry_1->move) - int(entry_2->move); // deterministic order
+   }
+}
+
+// move_compare()
+
+static int move_compare(const void * p1, const void * p2) {
+
+   const entry_t * entry_1, * entry_2;
+
+   ASSERT(p1!=NULL);
+   ASSERT(p2!=NULL);
+
+   entry_1 = (const entry_t *) p1;
+   entry_2 = (const entry_t *) p2;
+
+   if (entry_1->key > entry_2->key) {
+      return +1;
+   } else if (entry_1->key < entry_2->key) {
+      return -1;
+   } else {
+      return int(entry_1->move) - int(entry_2->move);
+   }
+}
+
+// read_integer()
+
+static uint64 read_integer(FILE * file, int size) {
+
+   uint64 n;
+   int i;
+   int b;
+
+   ASSERT(file!=NULL);
+   ASSERT(size>0&&size<=8);
+
+   n = 0;
+
+   for (i = 0; i < size; i++) {
+
+      b = fgetc(file);
+
+      if (b == EOF) {
+         if (feof(file)) {
+            my_fatal("read_integer(): fgetc(): EOF reached\n");
+         } else { // error
+            my_fatal("read_integer(): fgetc(): %s\n",strerror(errno));
+         }
+      }
+
+      ASSERT(b>=0&&b<256);
+      n = (n << 8) | b;
    }
+
+   return n;
 }
 
 // write_integer()
@@ -761,5 +3728,97 @@ static void write_integer(FILE * file, int size, uint64 n) {
    }
 }
 
+// read_record()
+
+static bool read_record(FILE * file, entry_t * entry) {
+
+   int c;
+
+   ASSERT(file!=NULL);
+   ASSERT(entry!=NULL);
+
+   c = getc(file);
+
+   if (c == EOF) {
+      if (ferror(file)) my_fatal("read_record(): getc(): %s\n",strerror(errno));
+      return false;
+   }
+
+   ungetc(c,file);
+
+   entry->key = read_integer(file,8);
+   entry->move = read_integer(file,2);
+   entry->colour = read_integer(file,1);
+   entry->n = read_varint(file);
+   entry->sum = read_varint(file);
+
+   return true;
+}
+
+// write_record()
+
+static void write_record(FILE * file, const entry_t * entry) {
+
+   ASSERT(file!=NULL);
+   ASSERT(entry!=NULL);
+
+   // a run or -append state record, most counts take one byte
+
+   write_integer(file,8,entry->key);
+   write_integer(file,2,entry->move);
+   write_integer(file,1,entry->colour);
+   write_varint(file,entry->n);
+   write_varint(file,entry->sum);
+}
+
+// read_varint()
+
+static uint32 read_varint(FILE * file) {
+
+   uint32 n;
+   int shift;
+   int b;
+
+   ASSERT(file!=NULL);
+
+   // 7 bits per byte, low bits first, like put_varint()
+
+   n = 0;
+
+   for (shift = 0; shift < 35; shift += 7) {
+
+      b = fgetc(file);
+
+      if (b == EOF) {
+         if (feof(file)) {
+            my_fatal("read_varint(): fgetc(): EOF reached\n");
+         } else { // error
+            my_fatal("read_varint(): fgetc(): %s\n",strerror(errno));
+         }
+      }
+
+      n |= uint32(b & 0x7F) << shift;
+      if ((b & 0x80) == 0) return n;
+   }
+
+   my_fatal("read_varint(): invalid varint\n");
+
+   return 0;
+}
+
+// write_varint()
+
+static void write_varint(FILE * file, uint32 n) {
+
+   ASSERT(file!=NULL);
+
+   while (n >= 0x80) {
+      fputc(int((n & 0x7F) | 0x80),file);
+      n >>= 7;
+   }
+
+   fputc(int(n),file);
+}
+
 // end of book_make.cpp
 
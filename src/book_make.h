@@ -8,13 +8,16 @@
 
 #include "util.h"
 #include "leveldb/db.h"
+#include "leveldb/env.h"
 #include "leveldb/slice.h"
 
 
 
 // functions
 
-extern void book_make (int argc, char * argv[]);
+extern void book_make  (int argc, char * argv[]);
+extern void book_bench (int argc, char * argv[]);
+extern void san_bench  (int argc, char * argv[]);
 
 #endif // !defined BOOK_MAKE_H
 
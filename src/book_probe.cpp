@@ -0,0 +1,359 @@
+
+// book_probe.cpp
+
+// includes
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "board.h"
+#include "book.h"
+#include "book_probe.h"
+#include "colour.h"
+#include "fen.h"
+#include "hash.h"
+#include "move.h"
+#include "piece.h"
+#include "square.h"
+#include "util.h"
+
+// constants
+
+static const int FormatText = 1;
+static const int FormatBinary = 2;
+
+static const int BufferSize = 1 << 20;
+
+// prototypes
+
+static int    read_probes   (FILE * file, book_probe_t * * probe, bool decimal);
+static bool   parse_key     (const char string[], bool decimal, uint64 * key);
+static uint64 fen_key       (board_t * board);
+
+static void   write_result  (FILE * file, int format, int index, const book_entry_t * entry);
+static void   move_string   (int move, char string[]);
+
+static void   write_integer (FILE * file, int size, uint64 n);
+
+// functions
+
+// book_probe()
+
+void book_probe(int argc, char * argv[]) {
+
+   int i;
+   const char * bin_file;
+   const char * in_file;
+   const char * out_file;
+   int format;
+   bool decimal;
+   FILE * in, * out;
+   book_probe_t * probe;
+   int probe_nb;
+   int pos, found_nb;
+   book_entry_t entry[1];
+
+   bin_file = NULL;
+   my_string_set(&bin_file,"book.bin");
+
+   in_file = NULL;
+   my_string_set(&in_file,"-");
+
+   out_file = NULL;
+   my_string_set(&out_file,"-");
+
+   format = FormatText;
+   decimal = false;
+
+   for (i = 1; i < argc; i++) {
+
+      if (false) {
+
+      } else if (my_string_equal(argv[i],"book-probe")) {
+
+         // skip
+
+      } else if (my_string_equal(argv[i],"-bin")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_probe(): missing argument\n");
+
+         my_string_set(&bin_file,argv[i]);
+
+      } else if (my_string_equal(argv[i],"-in")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_probe(): missing argument\n");
+
+         my_string_set(&in_file,argv[i]);
+
+      } else if (my_string_equal(argv[i],"-out")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_probe(): missing argument\n");
+
+         my_string_set(&out_file,argv[i]);
+
+      } else if (my_string_equal(argv[i],"-format")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("book_probe(): missing argument\n");
+
+         if (false) {
+         } else if (my_string_equal(argv[i],"text")) {
+            format = FormatText;
+         } else if (my_string_equal(argv[i],"binary")) {
+            format = FormatBinary;
+         } else {
+            my_fatal("book_probe(): unknown format \"%s\"\n",argv[i]);
+         }
+
+      } else if (my_string_equal(argv[i],"-decimal")) {
+
+         decimal = true;
+
+      } else {
+
+         my_fatal("book_probe(): unknown option \"%s\"\n",argv[i]);
+      }
+   }
+
+   // read the positions, "-" is stdin
+
+   if (my_string_equal(in_file,"-")) {
+      in = stdin;
+   } else {
+      in = fopen(in_file,"r");
+      if (in == NULL) my_fatal("book_probe(): can't open file \"%s\": %s\n",in_file,strerror(errno));
+   }
+
+   probe_nb = read_probes(in,&probe,decimal);
+
+   if (in != stdin) fclose(in);
+
+   // one pass over the book
+
+   book_clear();
+   book_open(bin_file);
+
+   book_find_keys(probe,probe_nb);
+
+   // one line or record per book entry, in key order, "-" is stdout
+
+   if (my_string_equal(out_file,"-")) {
+      out = stdout;
+   } else {
+      out = fopen(out_file,(format==FormatBinary)?"wb":"w");
+      if (out == NULL) my_fatal("book_probe(): can't open file \"%s\" for writing: %s\n",out_file,strerror(errno));
+   }
+
+   setvbuf(out,NULL,_IOFBF,BufferSize);
+
+   found_nb = 0;
+
+   for (i = 0; i < probe_nb; i++) {
+
+      if (probe[i].pos < 0) {
+
+         // a position that is not in the book gets a single empty entry
+
+         entry->key = probe[i].key;
+         entry->move = 0;
+         entry->count = 0;
+         entry->n = 0;
+         entry->sum = 0;
+
+         write_result(out,format,probe[i].index,entry);
+
+         continue;
+      }
+
+      found_nb++;
+
+      for (pos = probe[i].pos; pos < probe[i].pos + probe[i].size; pos++) {
+         book_read_entry(entry,pos);
+         write_result(out,format,probe[i].index,entry);
+      }
+   }
+
+   if (out == stdout) {
+      if (fflush(out) == EOF) my_fatal("book_probe(): fflush(): %s\n",strerror(errno));
+   } else {
+      if (fclose(out) == EOF) my_fatal("book_probe(): fclose(): %s\n",strerror(errno));
+      printf("%d position%s, %d in the book.\n",probe_nb,(probe_nb!=1)?"s":"",found_nb);
+   }
+
+   book_close();
+
+   my_free(probe);
+}
+
+// read_probes()
+
+static int read_probes(FILE * file, book_probe_t * * probe, bool decimal) {
+
+   char line[256];
+   int line_nb;
+   int size, alloc;
+   board_t board[1];
+   uint64 key;
+
+   ASSERT(file!=NULL);
+   ASSERT(probe!=NULL);
+
+   // a FEN (it has a '/') or a key per line, empty lines are skipped
+
+   size = 0;
+   alloc = 1024;
+   *probe = (book_probe_t *) my_malloc(alloc*sizeof(book_probe_t));
+
+   for (line_nb = 1; my_file_read_line(file,line,256); line_nb++) {
+
+      if (my_string_empty(line)) continue;
+
+      if (strchr(line,'/') != NULL) {
+         if (!board_from_fen(board,line)) my_fatal("read_probes(): bad FEN at line %d\n",line_nb);
+         key = fen_key(board);
+      } else {
+         if (!parse_key(line,decimal,&key)) my_fatal("read_probes(): bad key at line %d\n",line_nb);
+      }
+
+      if (size == alloc) {
+         alloc *= 2;
+         *probe = (book_probe_t *) my_realloc(*probe,alloc*sizeof(book_probe_t));
+      }
+
+      (*probe)[size].key = key;
+      (*probe)[size].index = size;
+      (*probe)[size].pos = -1;
+      (*probe)[size].size = 0;
+      size++;
+   }
+
+   return size;
+}
+
+// parse_key()
+
+static bool parse_key(const char string[], bool decimal, uint64 * key) {
+
+   char * end;
+
+   ASSERT(string!=NULL);
+   ASSERT(key!=NULL);
+
+   // hexadecimal like the output, optionally "0x", or decimal like the leveldb index
+
+   errno = 0;
+   *key = strtoull(string,&end,decimal?10:16);
+
+   if (errno != 0 || end == string) return false;
+
+   while (*end == ' ' || *end == '\t') end++;
+
+   return *end == '\0';
+}
+
+// fen_key()
+
+static uint64 fen_key(board_t * board) {
+
+   int sq, pawn;
+
+   ASSERT(board!=NULL);
+
+   // a FEN may name an en-passant square no pawn can take on, move_do() and
+   // hence make-book only keep the ones that matter for the key
+
+   sq = board->ep_square;
+
+   if (sq != SquareNone) {
+
+      sq += colour_is_white(board->turn) ? -16 : +16; // the pawn that moved
+      pawn = piece_make_pawn(board->turn);
+
+      if (board->square[sq-1] != pawn && board->square[sq+1] != pawn) {
+         board->ep_square = SquareNone;
+         board->key = hash_key(board);
+      }
+   }
+
+   return board->key;
+}
+
+// write_result()
+
+static void write_result(FILE * file, int format, int index, const book_entry_t * entry) {
+
+   char string[16];
+
+   ASSERT(file!=NULL);
+   ASSERT(format==FormatText||format==FormatBinary);
+   ASSERT(index>=0);
+   ASSERT(entry!=NULL);
+
+   if (format == FormatBinary) {
+
+      // the input line, then the 16-byte book entry
+
+      write_integer(file,4,index);
+      write_integer(file,8,entry->key);
+      write_integer(file,2,entry->move);
+      write_integer(file,2,entry->count);
+      write_integer(file,2,entry->n);
+      write_integer(file,2,entry->sum);
+
+   } else {
+
+      move_string(entry->move,string);
+      fprintf(file,"%d\t" U64_FORMAT "\t%s\t%d\t%d\t%d\n",index,entry->key,string,entry->count,entry->n,entry->sum);
+   }
+}
+
+// move_string()
+
+static void move_string(int move, char string[]) {
+
+   int promote;
+
+   ASSERT(string!=NULL);
+
+   // coordinates as stored in the book, castling is "king takes rook"
+
+   if (move == 0) {
+      strcpy(string,"-");
+      return;
+   }
+
+   if (!square_to_string(move_from(move),&string[0],3)) ASSERT(false);
+   if (!square_to_string(move_to(move),&string[2],3)) ASSERT(false);
+
+   promote = (move >> 12) & 7;
+
+   if (promote >= 1 && promote <= 4) {
+      string[4] = "nbrq"[promote-1];
+      string[5] = '\0';
+   }
+}
+
+// write_integer()
+
+static void write_integer(FILE * file, int size, uint64 n) {
+
+   int i;
+   int b;
+
+   ASSERT(file!=NULL);
+   ASSERT(size>0&&size<=8);
+   ASSERT(size==8||n>>(size*8)==0);
+
+   for (i = size-1; i >= 0; i--) {
+      b = (n >> (i*8)) & 0xFF;
+      ASSERT(b>=0&&b<256);
+      fputc(b,file);
+   }
+}
+
+// end of book_probe.cpp
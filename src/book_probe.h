@@ -0,0 +1,17 @@
+
+// book_probe.h
+
+#ifndef BOOK_PROBE_H
+#define BOOK_PROBE_H
+
+// includes
+
+#include "util.h"
+
+// functions
+
+extern void book_probe (int argc, char * argv[]);
+
+#endif // !defined BOOK_PROBE_H
+
+// end of book_probe.h
@@ -0,0 +1,104 @@
+#!/bin/sh
+
+# check_make_book.sh
+
+# builds the same book in the different ways make-book can, from games
+# where the most played positions go past the counts a book entry holds
+# (COUNT_MAX), and checks that the .bin files are identical, including one
+# kept up to date with -append
+
+# usage: sh check_make_book.sh [polyglot]
+
+set -e
+
+POLYGLOT=${1:-./polyglot}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# 40000 openings of 1 to 6 plies, that go past COUNT_MAX, and 20000 games
+# of pawn pushes, that fill the tables, with pseudo-random results
+
+awk 'function random(n) {
+   seed = (seed * 69069 + 1) % 4294967296;
+   return int(seed / 65536) % n;
+}
+BEGIN {
+   line[0] = "e4 e5 Nf3 Nc6 Bb5 a6";
+   line[1] = "e4 c5 Nf3 d6 d4 cxd4";
+   line[2] = "d4 d5 c4 e6 Nc3 Nf6";
+   line[3] = "d4 Nf6 c4 g6 Nc3 Bg7";
+   line[4] = "e4 e6 d4 d5 Nc3 Bb4";
+   line[5] = "c4 e5 Nc3 Nf6 g3 d5";
+   result[0] = "1-0"; result[1] = "0-1"; result[2] = "1/2-1/2";
+   seed = 12345;
+   for (game = 0; game < 60000; game++) {
+      if (game % 3 != 2) {
+         ply_nb = 1 + random(6);
+         split(line[random(6)], move, " ");
+      } else {
+         # one push per file and side, always legal
+         ply_nb = 8 + random(7);
+         for (i = 0; i < 8; i++) { file[0,i] = i; file[1,i] = i; }
+         for (side = 0; side < 2; side++) {
+            for (i = 7; i > 0; i--) {
+               j = random(i + 1);
+               tmp = file[side,i]; file[side,i] = file[side,j]; file[side,j] = tmp;
+            }
+         }
+         for (ply = 1; ply <= ply_nb; ply++) {
+            side = (ply + 1) % 2;
+            rank = (side == 0) ? 3 + random(2) : 6 - random(2);
+            move[ply] = substr("abcdefgh", file[side,int((ply - 1) / 2)] + 1, 1) rank;
+         }
+      }
+      res = result[random(3)];
+      printf "[Event \"?\"]\n[Result \"%s\"]\n\n", res;
+      for (ply = 1; ply <= ply_nb; ply++) {
+         if (ply % 2 == 1) printf "%d. ", (ply + 1) / 2;
+         printf "%s ", move[ply];
+      }
+      printf "%s\n\n", res;
+   }
+}' > "$DIR/games.pgn"
+
+build() {
+   name=$1
+   shift
+   "$POLYGLOT" make-book -pgn "$DIR/games.pgn" -bin "$DIR/$name.bin" -min-game 1 "$@" > /dev/null
+}
+
+check() {
+   if cmp -s "$DIR/serial.bin" "$DIR/$1.bin"; then
+      echo "$1: ok"
+   else
+      echo "$1: differs from the serial book"
+      exit 1
+   fi
+}
+
+build serial
+build threads -threads 4
+check threads
+
+build pipeline -pipeline 2
+check pipeline
+
+build two-pass -two-pass 1
+check two-pass
+
+build max-memory -max-memory 1
+check max-memory
+
+build max-memory-threads -max-memory 2 -threads 2
+check max-memory-threads
+
+# -append over a growing file: half the games, then a game still being
+# written, then the rest
+
+awk '/^\[Event/ { game++ } game <= 30000' "$DIR/games.pgn" > "$DIR/growing.pgn"
+"$POLYGLOT" make-book -pgn "$DIR/growing.pgn" -bin "$DIR/append.bin" -min-game 1 -append > /dev/null
+printf '[Event "?"]\n[Result "1-0"]\n\n1. d4 d5 2. c4 {still' >> "$DIR/growing.pgn"
+"$POLYGLOT" make-book -pgn "$DIR/growing.pgn" -bin "$DIR/append.bin" -min-game 1 -append > /dev/null
+cp "$DIR/games.pgn" "$DIR/growing.pgn"
+"$POLYGLOT" make-book -pgn "$DIR/growing.pgn" -bin "$DIR/append.bin" -min-game 1 -append > /dev/null
+check append
@@ -0,0 +1,78 @@
+
+// dedupe.cpp
+
+// set of game hashes for make-book -dedupe: buckets of DedupeWays hashes,
+// a full bucket forgets one of its hashes, so the set never grows past
+// its budget and only a repeat of a forgotten game goes unnoticed
+
+// includes
+
+#include <cstring>
+
+#include "dedupe.h"
+#include "util.h"
+
+// functions
+
+// dedupe_init()
+
+void dedupe_init(dedupe_t * dedupe, int mb) {
+
+   ASSERT(dedupe!=NULL);
+   ASSERT(mb>=1);
+
+   dedupe->bucket_nb = uint64(mb) * 1048576 / (DedupeWays * sizeof(uint64));
+   dedupe->evicted = 0;
+
+   dedupe->hash = (uint64 *) my_malloc(dedupe->bucket_nb*DedupeWays*sizeof(uint64));
+   memset(dedupe->hash,0,dedupe->bucket_nb*DedupeWays*sizeof(uint64));
+}
+
+// dedupe_free()
+
+void dedupe_free(dedupe_t * dedupe) {
+
+   ASSERT(dedupe!=NULL);
+
+   my_free(dedupe->hash);
+
+   dedupe->hash = NULL;
+   dedupe->bucket_nb = 0;
+}
+
+// dedupe_seen()
+
+bool dedupe_seen(dedupe_t * dedupe, uint64 hash) {
+
+   uint64 * bucket;
+   int way;
+
+   ASSERT(dedupe!=NULL);
+   ASSERT(dedupe->hash!=NULL);
+
+   // adds hash to the set, returns true if it was already there
+
+   if (hash == 0) hash = 1; // 0 marks a free slot
+
+   bucket = &dedupe->hash[(hash % dedupe->bucket_nb) * DedupeWays];
+
+   for (way = 0; way < DedupeWays; way++) {
+
+      if (bucket[way] == hash) return true;
+
+      if (bucket[way] == 0) {
+         bucket[way] = hash;
+         return false;
+      }
+   }
+
+   // full bucket, replace a hash picked by the high bits of the new one
+
+   bucket[hash>>62] = hash;
+   dedupe->evicted++;
+
+   return false;
+}
+
+// end of dedupe.cpp
+
@@ -0,0 +1,33 @@
+
+// dedupe.h
+
+#ifndef DEDUPE_H
+#define DEDUPE_H
+
+// includes
+
+#include "util.h"
+
+// constants
+
+const int DedupeWays = 4; // hashes per bucket
+
+// types
+
+struct dedupe_t {
+   uint64 bucket_nb;
+   uint64 * hash; // DedupeWays per bucket, 0 for a free slot
+   int evicted;
+};
+
+// functions
+
+extern void dedupe_init (dedupe_t * dedupe, int mb);
+extern void dedupe_free (dedupe_t * dedupe);
+
+extern bool dedupe_seen (dedupe_t * dedupe, uint64 hash);
+
+#endif // !defined DEDUPE_H
+
+// end of dedupe.h
+
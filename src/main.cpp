@@ -13,8 +13,11 @@
 #include "attack.h"
 #include "board.h"
 #include "book.h"
+#include "book_compress.h"
+#include "book_index.h"
 #include "book_make.h"
 #include "book_merge.h"
+#include "book_probe.h"
 #include "engine.h"
 #include "epd.h"
 #include "fen.h"
@@ -24,6 +27,7 @@
 #include "move.h"
 #include "move_gen.h"
 #include "option.h"
+#include "pgn_index.h"
 #include "piece.h"
 #include "search.h"
 #include "square.h"
@@ -71,7 +75,14 @@ int main(int argc, char * argv[]) {
    }
 
    util_init();
-   printf("PolyGlot %s by Fabien Letouzey\n",Version);
+
+   // book-probe can write its results to stdout, the banner must not get in the way
+
+   if (argc >= 2 && my_string_equal(argv[1],"book-probe")) {
+      fprintf(stderr,"PolyGlot %s by Fabien Letouzey\n",Version);
+   } else {
+      printf("PolyGlot %s by Fabien Letouzey\n",Version);
+   }
 
    option_init();
 
@@ -90,6 +101,41 @@ int main(int argc, char * argv[]) {
       return EXIT_SUCCESS;
    }
 
+   if (argc >= 2 && my_string_equal(argv[1],"book-bench")) {
+      book_bench(argc,argv);
+      return EXIT_SUCCESS;
+   }
+
+   if (argc >= 2 && my_string_equal(argv[1],"san-bench")) {
+      san_bench(argc,argv);
+      return EXIT_SUCCESS;
+   }
+
+   if (argc >= 2 && my_string_equal(argv[1],"pgn-index")) {
+      pgn_index(argc,argv);
+      return EXIT_SUCCESS;
+   }
+
+   if (argc >= 2 && my_string_equal(argv[1],"book-index")) {
+      book_index(argc,argv);
+      return EXIT_SUCCESS;
+   }
+
+   if (argc >= 2 && my_string_equal(argv[1],"book-probe")) {
+      book_probe(argc,argv);
+      return EXIT_SUCCESS;
+   }
+
+   if (argc >= 2 && my_string_equal(argv[1],"book-compress")) {
+      book_compress(argc,argv);
+      return EXIT_SUCCESS;
+   }
+
+   if (argc >= 2 && my_string_equal(argv[1],"book-expand")) {
+      book_expand(argc,argv);
+      return EXIT_SUCCESS;
+   }
+
    if (argc >= 2 && my_string_equal(argv[1],"merge-book")) {
       book_merge(argc,argv);
       return EXIT_SUCCESS;
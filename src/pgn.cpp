@@ -6,20 +6,44 @@
 #include <cctype>
 #include <cerrno>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
 #include "pgn.h"
+#include "pgn_index.h"
 #include "util.h"
 
 // constants
 
 static const bool DispMove = false;
 static const bool DispToken = false;
-static const bool DispChar = false;
 
 static const int TAB_SIZE = 8;
 
-static const int CHAR_EOF = 256;
+static const int BlockSize = 1 << 20; // read from the decompressor at once
+static const int LineMax = 1 << 16; // kept before the window for columns
+
+// characters that stop the bulk skipping of moves: nesting, comments,
+// strings, the results and the next tag section (same as is_skip_stop())
+
+static const char SkipStop[] = "(){;%\"*-/[";
+static const int SkipStopNb = sizeof(SkipStop) - 1;
+
+static const int TagTextSize = 1024; // initial arena sizes, grown as needed
+static const int TagSize = 16;
 
 // types
 
@@ -33,20 +57,67 @@ enum token_t {
    TOKEN_RESULT  = 261
 };
 
+// types
+
+struct decompressor_t {
+   const char * magic;
+   int size;
+   const char * command;
+};
+
+// variables
+
+static const decompressor_t Decompressor[] = {
+   { "\x1F\x8B", 2, "gzip" },
+   { "\x28\xB5\x2F\xFD", 4, "zstd" },
+   { "\xFD\x37\x7A\x58\x5A\x00", 6, "xz" },
+   { NULL, 0, NULL },
+};
+
+static const char * const TagName[TAG_NB] = {
+   "Event", "Site", "Date", "White", "Black", "Result", "WhiteElo", "BlackElo",
+   "ECO", "FEN", "PlyCount", "EventDate", "EventType",
+};
+
+// perfect hash of the names above on their first and second-to-last
+// characters, see tag_id()
+
+static const sint8 TagHash[32] = {
+   -1, -1, -1, -1, -1, -1, -1, -1,
+   TAG_DATE, TAG_EVENT_DATE, -1, TAG_EVENT, -1, -1, TAG_RESULT, -1,
+   -1, TAG_BLACK, -1, TAG_WHITE_ELO, TAG_ECO, TAG_EVENT_TYPE, TAG_PLY_COUNT, TAG_SITE,
+   -1, -1, -1, TAG_WHITE, -1, -1, TAG_BLACK_ELO, TAG_FEN,
+};
+
 // prototypes
 
+static void pgn_spawn        (pgn_t * pgn, int fd, const char command[]);
+static bool pgn_fill         (pgn_t * pgn, long int keep);
+static const char * decompressor (int fd);
+
+static int  pgn_tag_copy     (pgn_t * pgn);
+static int  tag_id           (const char name[], int length);
+
 static void pgn_token_read   (pgn_t * pgn);
 static void pgn_token_unread (pgn_t * pgn);
+static void pgn_token_copy   (const pgn_t * pgn, char string[]);
+static bool pgn_token_equal  (const pgn_t * pgn, const char string[]);
 
 static void pgn_read_token   (pgn_t * pgn);
+static void pgn_read_string  (pgn_t * pgn);
+
+static long int find_game     (FILE * file, long int pos);
+static bool is_game_start    (FILE * file, long int pos);
+static bool is_game_complete (const char text[], long int size);
 
 static bool is_symbol_start  (int c);
 static bool is_symbol_next   (int c);
 
 static void pgn_skip_blanks  (pgn_t * pgn);
-
-static void pgn_char_read    (pgn_t * pgn);
-static void pgn_char_unread  (pgn_t * pgn);
+static bool pgn_skip_to      (pgn_t * pgn, int c);
+static void pgn_skip_text    (pgn_t * pgn);
+static long int skip_scan     (const char data[], long int pos, long int end);
+static bool is_skip_stop     (int c);
 
 // functions
 
@@ -54,134 +125,459 @@ static void pgn_char_unread  (pgn_t * pgn);
 
 void pgn_open(pgn_t * pgn, const char file_name[]) {
 
+   int fd;
+   struct stat st;
+   const char * command;
+   long int done;
+   ssize_t n;
+   int i;
+
    ASSERT(pgn!=NULL);
    ASSERT(file_name!=NULL);
 
-   pgn->file = fopen(file_name,"r");
-   if (pgn->file == NULL) my_fatal("pgn_open(): can't open file \"%s\": %s\n",file_name,strerror(errno));
+   fd = open(file_name,O_RDONLY);
+   if (fd == -1) my_fatal("pgn_open(): can't open file \"%s\": %s\n",file_name,strerror(errno));
+
+   if (fstat(fd,&st) == -1) my_fatal("pgn_open(): fstat(): %s\n",strerror(errno));
+
+   pgn->data = NULL;
+   pgn->size = 0;
+   pgn->mapped = false;
+
+   pgn->buffer = NULL;
+   pgn->buffer_size = 0;
+   pgn->base = 0;
+   pgn->base_line = 1;
+   pgn->fd = -1;
+   pgn->pid = -1;
+
+   command = decompressor(fd);
+
+   if (command != NULL) {
+
+      // compressed, decoded by a child process while we parse, see pgn_fill()
+
+      pgn_spawn(pgn,fd,command);
+
+   } else if (st.st_size > 0) {
+
+      // the whole file is mapped, tokens point straight into it
+
+      pgn->size = st.st_size;
 
-   pgn->char_hack = CHAR_EOF; // DEBUG
-   pgn->char_line = 1;
-   pgn->char_column = 0;
-   pgn->char_unread = false;
-   pgn->char_first = true;
+      void * data = mmap(NULL,pgn->size,PROT_READ,MAP_PRIVATE,fd,0);
+
+      if (data != MAP_FAILED) {
+
+         madvise(data,pgn->size,MADV_SEQUENTIAL);
+
+         pgn->data = (const char *) data;
+         pgn->mapped = true;
+
+      } else {
+
+         // no mmap() for this file, read it into memory instead
+
+         pgn->buffer = (char *) my_malloc(pgn->size);
+         pgn->buffer_size = pgn->size;
+
+         for (done = 0; done < pgn->size; done += n) {
+            n = read(fd,pgn->buffer+done,pgn->size-done);
+            if (n == -1) my_fatal("pgn_open(): read(): %s\n",strerror(errno));
+            if (n == 0) break;
+         }
+
+         pgn->data = pgn->buffer;
+         pgn->size = done;
+      }
+   }
+
+   close(fd);
+
+   pgn->pos = 0;
+   pgn->stop_pos = -1;
+
+   pgn->line_pos = 0;
+   pgn->line_nb = 1;
 
    pgn->token_type = TOKEN_ERROR; // DEBUG
-   strcpy(pgn->token_string,"?"); // DEBUG
-   pgn->token_length = -1; // DEBUG
-   pgn->token_line = -1; // DEBUG
-   pgn->token_column = -1; // DEBUG
+   pgn->token_string = "?"; // DEBUG
+   pgn->token_length = 1; // DEBUG
+   pgn->token_pos = -1; // DEBUG
    pgn->token_unread = false;
    pgn->token_first = true;
 
-   strcpy(pgn->result,"?"); // DEBUG
-   strcpy(pgn->fen,"?"); // DEBUG
+   pgn->tag_text_alloc = TagTextSize;
+   pgn->tag_text = (char *) my_malloc(pgn->tag_text_alloc);
+   pgn->tag_text_size = 0;
+
+   pgn->tag_alloc = TagSize;
+   pgn->tag = (pgn_tag_t *) my_malloc(pgn->tag_alloc*sizeof(pgn_tag_t));
+   pgn->tag_nb = 0;
 
-   pgn->move_line = -1; // DEBUG
-   pgn->move_column = -1; // DEBUG
+   for (i = 0; i < TAG_NB; i++) pgn->tag_index[i] = -1;
+
+   pgn->move_pos = -1; // DEBUG
    pgn->last_stream_pos = -1;
 }
 
+// pgn_open_range()
+
+void pgn_open_range(pgn_t * pgn, const char file_name[], long int start_pos, long int stop_pos) {
+
+   ASSERT(pgn!=NULL);
+   ASSERT(file_name!=NULL);
+   ASSERT(start_pos>=0);
+   ASSERT(stop_pos==-1||stop_pos>=start_pos);
+
+   pgn_open(pgn,file_name);
+
+   // a compressed file can't seek, it is decoded up to start_pos
+
+   while (start_pos > pgn->size && pgn_fill(pgn,pgn->size))
+      ;
+
+   if (start_pos > pgn->size) {
+      my_fatal("pgn_open_range(): \"%s\" is shorter than %ld bytes\n",file_name,start_pos);
+   }
+
+   pgn->pos = start_pos;
+   pgn->stop_pos = stop_pos;
+}
+
 // pgn_close()
 
 void pgn_close(pgn_t * pgn) {
 
    ASSERT(pgn!=NULL);
 
-   fclose(pgn->file);
+   if (pgn->fd != -1) {
+
+      // stopped before the end, the decompressor gets SIGPIPE
+
+      close(pgn->fd);
+      waitpid(pgn->pid,NULL,0);
+
+      pgn->fd = -1;
+   }
+
+   if (pgn->mapped) {
+      munmap((void *) pgn->data,pgn->size);
+   } else if (pgn->buffer != NULL) {
+      my_free(pgn->buffer);
+   }
+
+   pgn->data = NULL;
+   pgn->size = 0;
+   pgn->buffer = NULL;
+
+   my_free(pgn->tag_text);
+   my_free(pgn->tag);
+
+   pgn->tag_text = NULL;
+   pgn->tag = NULL;
+}
+
+// pgn_is_compressed()
+
+bool pgn_is_compressed(const char file_name[]) {
+
+   int fd;
+   bool compressed;
+
+   ASSERT(file_name!=NULL);
+
+   fd = open(file_name,O_RDONLY);
+   if (fd == -1) my_fatal("pgn_is_compressed(): can't open file \"%s\": %s\n",file_name,strerror(errno));
+
+   compressed = decompressor(fd) != NULL;
+
+   close(fd);
+
+   return compressed;
+}
+
+// pgn_tell()
+
+long int pgn_tell(const pgn_t * pgn) {
+
+   ASSERT(pgn!=NULL);
+
+   if (pgn->token_unread) return pgn->token_pos;
+
+   return pgn->pos;
+}
+
+// pgn_line_column()
+
+void pgn_line_column(pgn_t * pgn, long int pos, int * line, int * column) {
+
+   const char * p;
+   long int start;
+   int col;
+
+   ASSERT(pgn!=NULL);
+   ASSERT(line!=NULL);
+   ASSERT(column!=NULL);
+
+   // only used for messages, the lexer doesn't count lines
+
+   while (pos > pgn->size && pgn_fill(pgn,pgn->size)) // a compressed file read for messages only
+      ;
+
+   if (pos < pgn->base || pos > pgn->size) {
+      *line = -1;
+      *column = -1;
+      return;
+   }
+
+   if (pos < pgn->line_pos || pgn->line_pos < pgn->base) {
+      pgn->line_pos = pgn->base;
+      pgn->line_nb = pgn->base_line;
+   }
+
+   // count the newlines since the last call
+
+   while (pgn->line_pos < pos) {
+
+      p = (const char *) memchr(&pgn->data[pgn->line_pos],'\n',pos-pgn->line_pos);
+      if (p == NULL) break;
+
+      pgn->line_nb++;
+      pgn->line_pos = (p - pgn->data) + 1;
+   }
+
+   pgn->line_pos = pos;
+
+   // column of pos in its line, like an editor would show it
+
+   for (start = pos; start > pgn->base && pgn->data[start-1] != '\n'; start--)
+      ;
+
+   col = 0;
+
+   for (; start < pos; start++) {
+      if (pgn->data[start] == '\t') {
+         col += TAB_SIZE - (col % TAB_SIZE);
+      } else {
+         col++;
+      }
+   }
+
+   *line = pgn->line_nb;
+   *column = col;
+}
+
+// pgn_split()
+
+int pgn_split(const char file_name[], long int start_pos, long int stop_pos, long int pos[], int n) {
+
+   FILE * file;
+   long int size;
+   pgi_t pgi[1];
+   bool indexed;
+   long int target;
+   int i, game;
+
+   ASSERT(file_name!=NULL);
+   ASSERT(start_pos>=0);
+   ASSERT(pos!=NULL);
+   ASSERT(n>0);
+
+   // cuts the file from start_pos into n game-aligned ranges [pos[i],pos[i+1]),
+   // up to stop_pos or to the end of the file if it is -1
+
+   if (pgn_is_compressed(file_name)) {
+
+      // the size is only known at the end, -1 reads to EOF
+
+      if (n > 1) my_fatal("pgn_split(): \"%s\" is compressed, it can't be split between threads\n",file_name);
+
+      pos[0] = start_pos;
+      pos[1] = -1;
+
+      return n;
+   }
+
+   indexed = pgi_open(pgi,file_name);
+
+   file = fopen(file_name,"rb");
+   if (file == NULL) my_fatal("pgn_split(): can't open file \"%s\": %s\n",file_name,strerror(errno));
+
+   if (fseek(file,0,SEEK_END) == -1) {
+      my_fatal("pgn_split(): fseek(): %s\n",strerror(errno));
+   }
+
+   size = ftell(file);
+   if (start_pos > size) my_fatal("pgn_split(): \"%s\" is shorter than %ld bytes\n",file_name,start_pos);
+
+   if (stop_pos != -1 && stop_pos < size) size = stop_pos;
+
+   pos[0] = start_pos;
+
+   for (i = 1; i < n; i++) {
+
+      target = start_pos + (long int)(double(size-start_pos)*double(i)/double(n));
+
+      // take the boundary from the sidecar if it has one there, games
+      // appended since it was built are found by scanning
+
+      game = (indexed) ? pgi_find(pgi,target) : pgi->size;
+
+      if (game < pgi->size && is_game_start(file,pgi->game[game].pos)) {
+         pos[i] = pgi->game[game].pos;
+      } else {
+         pos[i] = find_game(file,target);
+      }
+
+      if (pos[i] < pos[i-1]) pos[i] = pos[i-1];
+      if (pos[i] > size) pos[i] = size;
+   }
+
+   pos[n] = size;
+
+   fclose(file);
+   if (indexed) pgi_close(pgi);
+
+   return n;
+}
+
+// pgn_complete_size()
+
+long int pgn_complete_size(const char file_name[], long int start_pos) {
+
+   FILE * file;
+   long int size;
+   long int back, from;
+   long int last, pos;
+   char * text;
+
+   ASSERT(file_name!=NULL);
+   ASSERT(start_pos>=0);
+
+   // the offset after the last game that is completely written, a file
+   // that is still growing can end in the middle of one
+
+   if (pgn_is_compressed(file_name)) return -1; // read to EOF
+
+   file = fopen(file_name,"rb");
+   if (file == NULL) my_fatal("pgn_complete_size(): can't open file \"%s\": %s\n",file_name,strerror(errno));
+
+   if (fseek(file,0,SEEK_END) == -1) {
+      my_fatal("pgn_complete_size(): fseek(): %s\n",strerror(errno));
+   }
+
+   size = ftell(file);
+   if (start_pos > size) my_fatal("pgn_complete_size(): \"%s\" is shorter than %ld bytes\n",file_name,start_pos);
+
+   // start of the last game, looked for in a growing window before the end
+
+   last = start_pos;
+
+   for (back = 65536; true; back *= 2) {
+
+      from = (size - start_pos > back) ? size - back : start_pos;
+
+      for (pos = find_game(file,from); pos < size; pos = find_game(file,pos)) {
+         last = pos;
+      }
+
+      if (last > from || from == start_pos) break;
+   }
+
+   // only that one can be incomplete
+
+   text = (char *) my_malloc(size-last+1);
+
+   if (fseek(file,last,SEEK_SET) == -1) {
+      my_fatal("pgn_complete_size(): fseek(): %s\n",strerror(errno));
+   }
+
+   if (fread(text,1,size-last,file) != size_t(size-last)) {
+      my_fatal("pgn_complete_size(): fread(): %s\n",strerror(errno));
+   }
+
+   if (!is_game_complete(text,size-last)) size = last;
+
+   my_free(text);
+   fclose(file);
+
+   return size;
 }
 
 // pgn_next_game()
 
 bool pgn_next_game(pgn_t * pgn) {
 
-   char name[PGN_STRING_SIZE];
-   char value[PGN_STRING_SIZE];
+   int name, value;
+   int tag;
+   int line, column;
 
    ASSERT(pgn!=NULL);
 
    // init
 
-   strcpy(pgn->result,"*");
-   strcpy(pgn->white,"*");
-   strcpy(pgn->whiteelo,"*");
-   strcpy(pgn->black,"*");
-   strcpy(pgn->blackelo,"*");
-   strcpy(pgn->date,"*");
-   strcpy(pgn->event,"*");
-   strcpy(pgn->site,"*");
-   strcpy(pgn->eco,"*");   
    pgn->last_stream_pos = -1;
-   strcpy(pgn->fen,"");
-   
-   strcpy(pgn->plycount,"*");
-   strcpy(pgn->eventdate,"*");
-   strcpy(pgn->eventtype,"*");
+
+   pgn->tag_text_size = 0;
+   pgn->tag_nb = 0;
+
+   for (tag = 0; tag < TAG_NB; tag++) pgn->tag_index[tag] = -1;
 
    // loop
 
    while (true) {
 
-
       pgn_token_read(pgn);
       
       if (pgn->token_type != '[') break;
       
       if (pgn->last_stream_pos == -1) {
-          // before '['
-          pgn->last_stream_pos = ftell(pgn->file); 
+          // just after '['
+          pgn->last_stream_pos = pgn->token_pos + 1;
+
+          if (pgn->stop_pos != -1 && pgn->token_pos >= pgn->stop_pos) {
+             pgn_token_unread(pgn); // pgn_tell() is then the start of that game
+             return false; // the next game belongs to another range
+          }
        }
       
       // tag
 
       pgn_token_read(pgn);
       if (pgn->token_type != TOKEN_SYMBOL) {
-         my_log("pgn_next_game(): malformed tag at line %d, column %d\n",pgn->token_line,pgn->token_column);
+         pgn_line_column(pgn,pgn->token_pos,&line,&column);
+         my_log("pgn_next_game(): malformed tag at line %d, column %d\n",line,column);
       }
-      strcpy(name,pgn->token_string);
+      tag = tag_id(pgn->token_string,pgn->token_length);
+      name = pgn_tag_copy(pgn);
 
       pgn_token_read(pgn);
       if (pgn->token_type != TOKEN_STRING) {
-         my_log("pgn_next_game(): malformed tag at line %d, column %d\n",pgn->token_line,pgn->token_column);
+         pgn_line_column(pgn,pgn->token_pos,&line,&column);
+         my_log("pgn_next_game(): malformed tag at line %d, column %d\n",line,column);
       }
-      strcpy(value,pgn->token_string);
+      value = pgn_tag_copy(pgn);
 
       pgn_token_read(pgn);
       if (pgn->token_type != ']') {
-         my_log("pgn_next_game(): malformed tag at line %d, column %d\n",pgn->token_line,pgn->token_column);
+         pgn_line_column(pgn,pgn->token_pos,&line,&column);
+         my_log("pgn_next_game(): malformed tag at line %d, column %d\n",line,column);
       }
 
-      // special tag?
+      // add it, a repeated tag hides the earlier one
 
-      if (false) {
-      } else if (my_string_equal(name,"Result")) {
-         strcpy(pgn->result,value);
-      } else if (my_string_equal(name,"FEN")) {
-         strcpy(pgn->fen,value);
-      } else if (my_string_equal(name,"White")) {
-         strcpy(pgn->white,value);
-      } else if (my_string_equal(name,"WhiteElo")) {
-         strcpy(pgn->whiteelo,value);
-      } else if (my_string_equal(name,"Black")) {
-         strcpy(pgn->black,value);
-      } else if (my_string_equal(name,"BlackElo")) {
-         strcpy(pgn->blackelo,value);
-      } else if (my_string_equal(name,"Date")) {
-         strcpy(pgn->date,value);
-      } else if (my_string_equal(name,"Event")) {
-         strcpy(pgn->event,value);
-      } else if (my_string_equal(name,"Site")) {
-         strcpy(pgn->site,value);
-      } else if (my_string_equal(name,"ECO")) {
-         strcpy(pgn->eco,value);
-      } else if (my_string_equal(name,"PlyCount")) {
-         strcpy(pgn->plycount,value);
-      } else if (my_string_equal(name,"EventDate")) {
-         strcpy(pgn->eventdate,value);
-      } else if (my_string_equal(name,"EventType")) {
-         strcpy(pgn->eventtype,value);
+      if (pgn->tag_nb == pgn->tag_alloc) {
+         pgn->tag_alloc *= 2;
+         pgn->tag = (pgn_tag_t *) my_realloc(pgn->tag,pgn->tag_alloc*sizeof(pgn_tag_t));
       }
-      
+
+      pgn->tag[pgn->tag_nb].name = name;
+      pgn->tag[pgn->tag_nb].value = value;
+
+      if (tag != -1) pgn->tag_index[tag] = pgn->tag_nb;
+
+      pgn->tag_nb++;
    }
 
    if (pgn->token_type == TOKEN_EOF) return false;
@@ -191,11 +587,55 @@ bool pgn_next_game(pgn_t * pgn) {
    return true;
 }
 
+// pgn_tag()
+
+const char * pgn_tag(const pgn_t * pgn, int tag) {
+
+   int index;
+
+   ASSERT(pgn!=NULL);
+   ASSERT(tag>=0&&tag<TAG_NB);
+
+   index = pgn->tag_index[tag];
+   if (index == -1) return (tag == TAG_FEN) ? "" : "*";
+
+   return &pgn->tag_text[pgn->tag[index].value];
+}
+
+// pgn_tag_find()
+
+const char * pgn_tag_find(const pgn_t * pgn, const char name[]) {
+
+   int tag;
+   int index;
+
+   ASSERT(pgn!=NULL);
+   ASSERT(name!=NULL);
+
+   // returns NULL if the current game has no such tag
+
+   tag = tag_id(name,strlen(name));
+
+   if (tag != -1) {
+      index = pgn->tag_index[tag];
+      return (index != -1) ? &pgn->tag_text[pgn->tag[index].value] : NULL;
+   }
+
+   for (index = pgn->tag_nb-1; index >= 0; index--) {
+      if (my_string_equal(&pgn->tag_text[pgn->tag[index].name],name)) {
+         return &pgn->tag_text[pgn->tag[index].value];
+      }
+   }
+
+   return NULL;
+}
+
 // pgn_next_move()
 
 bool pgn_next_move(pgn_t * pgn, char string[], int size) {
 
    int depth;
+   int line, column;
 
    ASSERT(pgn!=NULL);
    ASSERT(string!=NULL);
@@ -203,8 +643,7 @@ bool pgn_next_move(pgn_t * pgn, char string[], int size) {
 
    // init
 
-   pgn->move_line = -1; // DEBUG
-   pgn->move_column = -1; // DEBUG
+   pgn->move_pos = -1; // DEBUG
 
    // loop
 
@@ -212,6 +651,10 @@ bool pgn_next_move(pgn_t * pgn, char string[], int size) {
 
    while (true) {
 
+      // moves inside a variation are not tokenised
+
+      if (depth > 0 && !pgn->token_unread) pgn_skip_text(pgn);
+
       pgn_token_read(pgn);
 
       if (false) {
@@ -227,7 +670,8 @@ bool pgn_next_move(pgn_t * pgn, char string[], int size) {
          // close RAV
 
          if (depth == 0) {
-            my_log("pgn_next_move(): malformed variation at line %d, column %d\n",pgn->token_line,pgn->token_column);
+            pgn_line_column(pgn,pgn->token_pos,&line,&column);
+            my_log("pgn_next_move(): malformed variation at line %d, column %d\n",line,column);
          }
 
          depth--;
@@ -238,62 +682,274 @@ bool pgn_next_move(pgn_t * pgn, char string[], int size) {
          // game finished
 
          if (depth > 0) {
-            my_log("pgn_next_move(): malformed variation at line %d, column %d\n",pgn->token_line,pgn->token_column);
+            pgn_line_column(pgn,pgn->token_pos,&line,&column);
+            my_log("pgn_next_move(): malformed variation at line %d, column %d\n",line,column);
+         }
+
+         return false;
+
+      } else if (pgn->token_type == '[') {
+
+         // no result, the next game starts here
+
+         pgn_line_column(pgn,pgn->token_pos,&line,&column);
+         my_log("pgn_next_move(): missing result at line %d, column %d\n",line,column);
+
+         pgn_token_unread(pgn);
+
+         return false;
+
+      } else if (pgn->token_type == TOKEN_EOF) {
+
+         pgn_line_column(pgn,pgn->token_pos,&line,&column);
+         my_fatal("pgn_next_move(): EOF in movetext at line %d, column %d\n",line,column);
+
+      } else {
+
+         // skip optional move number, what follows is handled as usual
+
+         if (pgn->token_type == TOKEN_INTEGER) {
+
+            do pgn_token_read(pgn); while (pgn->token_type == '.');
+
+            if (pgn->token_type != TOKEN_SYMBOL) {
+               pgn_token_unread(pgn);
+               continue;
+            }
+         }
+
+         // move must be a symbol
+
+         if (pgn->token_type != TOKEN_SYMBOL) {
+            pgn_line_column(pgn,pgn->token_pos,&line,&column);
+            my_log("pgn_next_move(): malformed move at line %d, column %d\n",line,column);
+            continue;
+         }
+
+         // store move for later use
+
+         if (depth == 0) {
+
+            if (pgn->token_length >= size) {
+               pgn_line_column(pgn,pgn->token_pos,&line,&column);
+               my_fatal("pgn_next_move(): move too long at line %d, column %d\n",line,column);
+            }
+
+            pgn_token_copy(pgn,string);
+            pgn->move_pos = pgn->token_pos;
+         }
+
+         // skip optional NAGs
+
+         do pgn_token_read(pgn); while (pgn->token_type == TOKEN_NAG);
+         pgn_token_unread(pgn);
+
+         // return move
+
+         if (depth == 0) {
+            if (DispMove) printf("move=\"%s\"\n",string);
+            return true;
          }
+      }
+   }
+
+   ASSERT(false);
+
+   return false;
+}
+
+// pgn_skip_game()
+
+void pgn_skip_game(pgn_t * pgn) {
+
+   int line, column;
+
+   ASSERT(pgn!=NULL);
+
+   // same as calling pgn_next_move() until it returns false, but moves
+   // are not tokenised
+
+   while (true) {
+
+      if (!pgn->token_unread) pgn_skip_text(pgn);
+
+      pgn_token_read(pgn);
+
+      if (false) {
+
+      } else if (pgn->token_type == TOKEN_RESULT) {
+
+         return;
+
+      } else if (pgn->token_type == '[') {
+
+         pgn_line_column(pgn,pgn->token_pos,&line,&column);
+         my_log("pgn_skip_game(): missing result at line %d, column %d\n",line,column);
+
+         pgn_token_unread(pgn);
+
+         return;
+
+      } else if (pgn->token_type == TOKEN_EOF) {
+
+         pgn_line_column(pgn,pgn->token_pos,&line,&column);
+         my_fatal("pgn_skip_game(): EOF in movetext at line %d, column %d\n",line,column);
+      }
+   }
+}
+
+// pgn_spawn()
+
+static void pgn_spawn(pgn_t * pgn, int fd, const char command[]) {
+
+   int from_child[2];
+   pid_t pid;
+
+   ASSERT(pgn!=NULL);
+   ASSERT(fd>=0);
+   ASSERT(command!=NULL);
+
+   // "<command> -dc" reads the file on its standard input
+
+   if (pipe(from_child) == -1) my_fatal("pgn_spawn(): pipe(): %s\n",strerror(errno));
+
+#if defined(F_SETPIPE_SZ)
+   fcntl(from_child[1],F_SETPIPE_SZ,BlockSize); // fewer context switches, a hint only
+#endif
+
+   fflush(stdout); // or the child would write it again on exit
+
+   pid = fork();
+
+   if (pid == -1) {
+
+      my_fatal("pgn_spawn(): fork(): %s\n",strerror(errno));
+
+   } else if (pid == 0) {
+
+      // child = decompressor
+
+      close(from_child[0]);
+
+      if (dup2(fd,STDIN_FILENO) == -1) my_fatal("pgn_spawn(): dup2(): %s\n",strerror(errno));
+      if (dup2(from_child[1],STDOUT_FILENO) == -1) my_fatal("pgn_spawn(): dup2(): %s\n",strerror(errno));
+
+      close(from_child[1]);
+      close(fd);
+
+      execlp(command,command,"-dc",(char *) NULL);
+
+      // execlp() only returns when an error has occured
+
+      my_fatal("pgn_spawn(): can't run \"%s\": %s\n",command,strerror(errno));
+   }
+
+   // parent = PolyGlot
+
+   close(from_child[1]);
+
+   pgn->fd = from_child[0];
+   pgn->pid = pid;
+
+   pgn->buffer = (char *) my_malloc(BlockSize);
+   pgn->buffer_size = BlockSize;
+   pgn->data = pgn->buffer;
+}
+
+// pgn_fill()
+
+static bool pgn_fill(pgn_t * pgn, long int keep) {
+
+   long int start, used;
+   const char * p;
+   ssize_t n;
+   int status;
+
+   ASSERT(pgn!=NULL);
+   ASSERT(keep>=pgn->base&&keep<=pgn->size);
+
+   // returns false at EOF. Only a compressed file is read in blocks; the
+   // window [base,size) slides over it, data[pos] stays valid for any
+   // file position in the window. Everything from keep on is kept.
+
+   if (pgn->fd == -1) return false;
+
+   // also keep the last move and the line keep is on (messages, '%' escapes)
+
+   if (pgn->move_pos >= pgn->base && pgn->move_pos < keep) keep = pgn->move_pos;
+
+   start = (keep - LineMax > pgn->base) ? keep - LineMax : pgn->base;
+   while (keep > start && pgn->data[keep-1] != '\n') keep--;
+   if (keep > start) keep--; // the newline itself
+
+   // drop the rest, counting its lines for pgn_line_column()
+
+   for (p = &pgn->data[pgn->base]; (p = (const char *) memchr(p,'\n',&pgn->data[keep]-p)) != NULL; p++) {
+      pgn->base_line++;
+   }
+
+   used = pgn->size - keep;
+   memmove(pgn->buffer,&pgn->buffer[keep-pgn->base],used);
+   pgn->base = keep;
+
+   if (pgn->buffer_size - used < BlockSize) {
+      while (pgn->buffer_size - used < BlockSize) pgn->buffer_size *= 2;
+      pgn->buffer = (char *) my_realloc(pgn->buffer,pgn->buffer_size);
+   }
+
+   pgn->data = pgn->buffer - pgn->base; // indexed by file position
 
-         return false;
+   // next block
 
-      } else {
+   do n = read(pgn->fd,&pgn->buffer[used],pgn->buffer_size-used); while (n == -1 && errno == EINTR);
+   if (n == -1) my_fatal("pgn_fill(): read(): %s\n",strerror(errno));
 
-         // skip optional move number
+   if (n == 0) {
 
-         if (pgn->token_type == TOKEN_INTEGER) {
-            do pgn_token_read(pgn); while (pgn->token_type == '.');
-         }
+      close(pgn->fd);
+      pgn->fd = -1;
 
-         // move must be a symbol
+      if (waitpid(pgn->pid,&status,0) == -1) my_fatal("pgn_fill(): waitpid(): %s\n",strerror(errno));
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) my_fatal("pgn_fill(): the PGN file couldn't be decompressed\n");
 
-         if (pgn->token_type != TOKEN_SYMBOL) {
-            my_log("pgn_next_move(): malformed move at line %d, column %d\n",pgn->token_line,pgn->token_column);
-            continue;
-         }
+      return false;
+   }
 
-         // store move for later use
+   pgn->size += n;
 
-         if (depth == 0) {
+   return true;
+}
 
-            if (pgn->token_length >= size) {
-               my_fatal("pgn_next_move(): move too long at line %d, column %d\n",pgn->token_line,pgn->token_column);
-            }
+// decompressor()
 
-            strcpy(string,pgn->token_string);
-            pgn->move_line = pgn->token_line;
-            pgn->move_column = pgn->token_column;
-         }
+static const char * decompressor(int fd) {
 
-         // skip optional NAGs
+   char magic[8];
+   ssize_t n;
+   int i;
 
-         do pgn_token_read(pgn); while (pgn->token_type == TOKEN_NAG);
-         pgn_token_unread(pgn);
+   ASSERT(fd>=0);
 
-         // return move
+   // the command that decompresses the file, NULL for a plain PGN file
 
-         if (depth == 0) {
-            if (DispMove) printf("move=\"%s\"\n",string);
-            return true;
-         }
+   n = pread(fd,magic,sizeof(magic),0);
+   if (n == -1) my_fatal("decompressor(): pread(): %s\n",strerror(errno));
+
+   for (i = 0; Decompressor[i].magic != NULL; i++) {
+      if (n >= Decompressor[i].size && memcmp(magic,Decompressor[i].magic,Decompressor[i].size) == 0) {
+         return Decompressor[i].command;
       }
    }
 
-   ASSERT(false);
-
-   return false;
+   return NULL;
 }
 
 // pgn_token_read()
 
 static void pgn_token_read(pgn_t * pgn) {
 
+   int line, column;
+
    ASSERT(pgn!=NULL);
 
    // token "stack"
@@ -315,9 +971,13 @@ static void pgn_token_read(pgn_t * pgn) {
    // read a new token
 
    pgn_read_token(pgn);
-   if (pgn->token_type == TOKEN_ERROR) my_log("pgn_token_read(): lexical error at line %d, column %d\n",pgn->char_line,pgn->char_column);
 
-   if (DispToken) printf("< L%d C%d \"%s\" (%03X)\n",pgn->token_line,pgn->token_column,pgn->token_string,pgn->token_type);
+   if (pgn->token_type == TOKEN_ERROR) {
+      pgn_line_column(pgn,pgn->token_pos,&line,&column);
+      my_log("pgn_token_read(): lexical error at line %d, column %d\n",line,column);
+   }
+
+   if (DispToken) printf("< P%ld \"%.*s\" (%03X)\n",pgn->token_pos,pgn->token_length,pgn->token_string,pgn->token_type);
 }
 
 // pgn_token_unread()
@@ -332,10 +992,84 @@ static void pgn_token_unread(pgn_t * pgn) {
    pgn->token_unread = true;
 }
 
+// pgn_tag_copy()
+
+static int pgn_tag_copy(pgn_t * pgn) {
+
+   int pos;
+
+   ASSERT(pgn!=NULL);
+   ASSERT(pgn->token_length>=0&&pgn->token_length<PGN_STRING_SIZE);
+
+   // appends the current token to the tag arena, returns its offset
+
+   while (pgn->tag_text_size + pgn->token_length + 1 > pgn->tag_text_alloc) {
+      pgn->tag_text_alloc *= 2;
+      pgn->tag_text = (char *) my_realloc(pgn->tag_text,pgn->tag_text_alloc);
+   }
+
+   pos = pgn->tag_text_size;
+
+   memcpy(&pgn->tag_text[pos],pgn->token_string,pgn->token_length);
+   pgn->tag_text[pos+pgn->token_length] = '\0';
+
+   pgn->tag_text_size += pgn->token_length + 1;
+
+   return pos;
+}
+
+// tag_id()
+
+static int tag_id(const char name[], int length) {
+
+   int tag;
+
+   ASSERT(name!=NULL);
+   ASSERT(length>=0);
+
+   // returns the tag_t of name (not NUL-terminated), -1 if pgn_tag() doesn't know it
+
+   if (length < 2) return -1;
+
+   tag = TagHash[((unsigned char) name[0] + 5 * (unsigned char) name[length-2]) & 31];
+
+   if (tag != -1 && (strncmp(TagName[tag],name,length) != 0 || TagName[tag][length] != '\0')) {
+      tag = -1;
+   }
+
+   return tag;
+}
+
+// pgn_token_copy()
+
+static void pgn_token_copy(const pgn_t * pgn, char string[]) {
+
+   ASSERT(pgn!=NULL);
+   ASSERT(string!=NULL);
+   ASSERT(pgn->token_length>=0&&pgn->token_length<PGN_STRING_SIZE);
+
+   memcpy(string,pgn->token_string,pgn->token_length);
+   string[pgn->token_length] = '\0';
+}
+
+// pgn_token_equal()
+
+static bool pgn_token_equal(const pgn_t * pgn, const char string[]) {
+
+   ASSERT(pgn!=NULL);
+   ASSERT(string!=NULL);
+
+   return strncmp(pgn->token_string,string,pgn->token_length) == 0 && string[pgn->token_length] == '\0';
+}
+
 // pgn_read_token()
 
 static void pgn_read_token(pgn_t * pgn) {
 
+   long int start;
+   int c;
+   int line, column;
+
    ASSERT(pgn!=NULL);
 
    // skip white-space characters
@@ -344,203 +1078,232 @@ static void pgn_read_token(pgn_t * pgn) {
 
    // init
 
+   start = pgn->pos;
+
    pgn->token_type = TOKEN_ERROR;
-   strcpy(pgn->token_string,"");
+   pgn->token_string = &pgn->data[start];
    pgn->token_length = 0;
-   pgn->token_line = pgn->char_line;
-   pgn->token_column = pgn->char_column;
+   pgn->token_pos = start;
 
    // determine token type
 
-   if (false) {
+   if (start >= pgn->size) {
+      pgn->token_type = TOKEN_EOF;
+      pgn->token_string = "";
+      return;
+   }
 
-   } else if (pgn->char_hack == CHAR_EOF) {
+   c = (unsigned char) pgn->data[start];
+   pgn->pos++;
 
-      pgn->token_type = TOKEN_EOF;
+   // pgn_fill() can move the data, views are taken once the token is complete
+
+   if (false) {
 
-   } else if (strchr(".[]()<>",pgn->char_hack) != NULL) {
+   } else if (c == '.' || c == '[' || c == ']' || c == '(' || c == ')' || c == '<' || c == '>') {
 
       // single-character token
 
-      pgn->token_type = pgn->char_hack;
-      sprintf(pgn->token_string,"%c",pgn->char_hack);
+      pgn->token_type = c;
       pgn->token_length = 1;
 
-   } else if (pgn->char_hack == '*') {
+   } else if (c == '*') {
 
       pgn->token_type = TOKEN_RESULT;
-      sprintf(pgn->token_string,"%c",pgn->char_hack);
       pgn->token_length = 1;
 
-   } else if (pgn->char_hack == '!') {
+   } else if (c == '!' || c == '?') {
 
-      pgn_char_read(pgn);
+      // "!", "?", "!!", "??", "!?" or "?!", as the NAG number
 
-      if (false) {
+      pgn->token_type = TOKEN_NAG;
+      pgn->token_length = 1;
 
-      } else if (pgn->char_hack == '!') { // "!!"
+      if (pgn->pos >= pgn->size) pgn_fill(pgn,start);
+
+      if (pgn->pos < pgn->size && (pgn->data[pgn->pos] == '!' || pgn->data[pgn->pos] == '?')) {
+         pgn->token_string = (c == '!') ? ((pgn->data[pgn->pos] == '!') ? "3" : "5") : ((pgn->data[pgn->pos] == '?') ? "4" : "6");
+         pgn->pos++;
+      } else {
+         pgn->token_string = (c == '!') ? "1" : "2";
+      }
 
-         pgn->token_type = TOKEN_NAG;
-         strcpy(pgn->token_string,"3");
-         pgn->token_length = 1;
+   } else if (is_symbol_start(c)) {
 
-      } else if (pgn->char_hack == '?') { // "!?"
+      // symbol, integer, or result
 
-         pgn->token_type = TOKEN_NAG;
-         strcpy(pgn->token_string,"5");
-         pgn->token_length = 1;
+      pgn->token_type = (isdigit(c)) ? TOKEN_INTEGER : TOKEN_SYMBOL;
 
-      } else { // "!"
+      while (true) {
 
-         pgn_char_unread(pgn);
+         if (pgn->pos >= pgn->size && !pgn_fill(pgn,start)) break;
+         if (!is_symbol_next((unsigned char) pgn->data[pgn->pos])) break;
 
-         pgn->token_type = TOKEN_NAG;
-         strcpy(pgn->token_string,"1");
-         pgn->token_length = 1;
+         if (!isdigit((unsigned char) pgn->data[pgn->pos])) pgn->token_type = TOKEN_SYMBOL;
+         pgn->pos++;
       }
 
-   } else if (pgn->char_hack == '?') {
+      pgn->token_string = &pgn->data[start];
+      pgn->token_length = int(pgn->pos - start);
 
-      pgn_char_read(pgn);
+      if (pgn->token_length >= PGN_STRING_SIZE) {
+         pgn_line_column(pgn,start,&line,&column);
+         my_fatal("pgn_read_token(): symbol too long at line %d, column %d\n",line,column);
+      }
 
-      if (false) {
+      if (pgn_token_equal(pgn,"1-0")
+       || pgn_token_equal(pgn,"0-1")
+       || pgn_token_equal(pgn,"1/2-1/2")) {
+         pgn->token_type = TOKEN_RESULT;
+      }
 
-      } else if (pgn->char_hack == '?') { // "??"
+   } else if (c == '"') {
 
-         pgn->token_type = TOKEN_NAG;
-         strcpy(pgn->token_string,"4");
-         pgn->token_length = 1;
+      pgn_read_string(pgn);
 
-      } else if (pgn->char_hack == '!') { // "?!"
+   } else if (c == '$') {
 
-         pgn->token_type = TOKEN_NAG;
-         strcpy(pgn->token_string,"6");
-         pgn->token_length = 1;
+      // NAG
 
-      } else { // "?"
+      pgn->token_type = TOKEN_NAG;
 
-         pgn_char_unread(pgn);
+      while (true) {
 
-         pgn->token_type = TOKEN_NAG;
-         strcpy(pgn->token_string,"2");
-         pgn->token_length = 1;
-      }
+         if (pgn->pos >= pgn->size && !pgn_fill(pgn,start)) break;
+         if (!isdigit((unsigned char) pgn->data[pgn->pos])) break;
 
-   } else if (is_symbol_start(pgn->char_hack)) {
+         if (pgn->token_length >= 3) {
+            pgn_line_column(pgn,pgn->pos,&line,&column);
+            my_fatal("pgn_read_token(): NAG too long at line %d, column %d\n",line,column);
+         }
 
-      // symbol, integer, or result
+         pgn->token_length++;
+         pgn->pos++;
+      }
 
-      pgn->token_type = TOKEN_INTEGER;
-      pgn->token_length = 0;
+      pgn->token_string = &pgn->data[start+1];
 
-      do {
+      if (pgn->token_length == 0) {
+         pgn_line_column(pgn,pgn->pos,&line,&column);
+         my_fatal("pgn_read_token(): malformed NAG at line %d, column %d\n",line,column);
+      }
 
-         if (pgn->token_length >= PGN_STRING_SIZE-1) {
-            my_fatal("pgn_read_token(): symbol too long at line %d, column %d\n",pgn->char_line,pgn->char_column);
-         }
+   } else {
 
-         if (!isdigit(pgn->char_hack)) pgn->token_type = TOKEN_SYMBOL;
+      // unknown token
 
-         pgn->token_string[pgn->token_length++] = pgn->char_hack;
+      // my_fatal("lexical error at line %d, column %d\n",line,column);
+   }
+}
 
-         pgn_char_read(pgn);
+// pgn_read_string()
 
-      } while (is_symbol_next(pgn->char_hack));
+static void pgn_read_string(pgn_t * pgn) {
 
-      pgn_char_unread(pgn);
+   const char * quote;
+   long int start, pos;
+   int c;
+   bool truncated;
+   int line, column;
 
-      ASSERT(pgn->token_length>0&&pgn->token_length<PGN_STRING_SIZE);
-      pgn->token_string[pgn->token_length] = '\0';
+   ASSERT(pgn!=NULL);
 
-      if (my_string_equal(pgn->token_string,"1-0")
-       || my_string_equal(pgn->token_string,"0-1")
-       || my_string_equal(pgn->token_string,"1/2-1/2")) {
-         pgn->token_type = TOKEN_RESULT;
-      }
+   start = pgn->pos; // after the opening '"'
 
-   } else if (pgn->char_hack == '"') {
+   pgn->token_type = TOKEN_STRING;
+   pgn->token_length = 0;
 
-      // string
+   // usual case, no escape: the string is a view into the file
 
-      pgn->token_type = TOKEN_STRING;
-      pgn->token_length = 0;
+   pos = start;
 
-      while (true) {
+   while ((quote = (const char *) memchr(&pgn->data[pos],'"',pgn->size-pos)) == NULL) {
 
-         pgn_char_read(pgn);
+      pos = pgn->size;
 
-         if (pgn->char_hack == CHAR_EOF) {
-            my_fatal("pgn_read_token(): EOF in string at line %d, column %d\n",pgn->char_line,pgn->char_column);
-         }
+      if (!pgn_fill(pgn,start)) {
+         pgn_line_column(pgn,pgn->size,&line,&column);
+         my_fatal("pgn_read_token(): EOF in string at line %d, column %d\n",line,column);
+      }
+   }
 
-         if (pgn->char_hack == '"') break;
+   if (memchr(&pgn->data[start],'\\',quote-&pgn->data[start]) == NULL) {
 
-         if (pgn->char_hack == '\\') {
+      pgn->pos = (quote - pgn->data) + 1;
+      pgn->token_string = &pgn->data[start];
+      pgn->token_length = int(quote - &pgn->data[start]);
 
-            pgn_char_read(pgn);
+      if (pgn->token_length >= PGN_STRING_SIZE) {
+         pgn_line_column(pgn,start,&line,&column);
+         my_log("pgn_read_token(): string too long at line %d, column %d\n",line,column);
+         pgn->token_length = PGN_STRING_SIZE - 1;
+      }
 
-            if (pgn->char_hack == CHAR_EOF) {
-               my_fatal("pgn_read_token(): EOF in string at line %d, column %d\n",pgn->char_line,pgn->char_column);
-            }
+      return;
+   }
 
-            if (pgn->char_hack != '"' && pgn->char_hack != '\\') {
+   // escapes, copy the string
 
-               // bad escape, ignore
+   pgn->token_string = pgn->token_buffer;
+   truncated = false;
 
-               if (pgn->token_length >= PGN_STRING_SIZE-1) {
-                  my_log("pgn_read_token(): string too long at line %d, column %d\n",pgn->char_line,pgn->char_column);
-                  break;
-               }
+   for (pos = start; true; pos++) {
 
-               pgn->token_string[pgn->token_length++] = '\\';
-            }
-         }
+      if (pos >= pgn->size && !pgn_fill(pgn,pos)) {
+         pgn_line_column(pgn,pgn->size,&line,&column);
+         my_fatal("pgn_read_token(): EOF in string at line %d, column %d\n",line,column);
+      }
 
-         if (pgn->token_length >= PGN_STRING_SIZE-1) {
-            my_log("pgn_read_token(): string too long at line %d, column %d\n",pgn->char_line,pgn->char_column);
-            break;
-         }
+      c = (unsigned char) pgn->data[pos];
 
-         pgn->token_string[pgn->token_length++] = pgn->char_hack;
-      }
+      if (c == '"') break;
 
-      ASSERT(pgn->token_length>=0&&pgn->token_length<PGN_STRING_SIZE);
-      pgn->token_string[pgn->token_length] = '\0';
+      if (c == '\\') {
 
-   } else if (pgn->char_hack == '$') {
+         pos++;
 
-      // NAG
+         if (pos >= pgn->size && !pgn_fill(pgn,pos)) {
+            pgn_line_column(pgn,pgn->size,&line,&column);
+            my_fatal("pgn_read_token(): EOF in string at line %d, column %d\n",line,column);
+         }
 
-      pgn->token_type = TOKEN_NAG;
-      pgn->token_length = 0;
+         c = (unsigned char) pgn->data[pos];
 
-      while (true) {
+         if (c != '"' && c != '\\') {
 
-         pgn_char_read(pgn);
+            // bad escape, ignore
 
-         if (!isdigit(pgn->char_hack)) break;
+            if (pgn->token_length >= PGN_STRING_SIZE-1) {
+               truncated = true;
+               break;
+            }
 
-         if (pgn->token_length >= 3) {
-            my_fatal("pgn_read_token(): NAG too long at line %d, column %d\n",pgn->char_line,pgn->char_column);
+            pgn->token_buffer[pgn->token_length++] = '\\';
          }
+      }
 
-         pgn->token_string[pgn->token_length++] = pgn->char_hack;
+      if (pgn->token_length >= PGN_STRING_SIZE-1) {
+         truncated = true;
+         break;
       }
 
-      pgn_char_unread(pgn);
+      pgn->token_buffer[pgn->token_length++] = c;
+   }
 
-      if (pgn->token_length == 0) {
-         my_fatal("pgn_read_token(): malformed NAG at line %d, column %d\n",pgn->char_line,pgn->char_column);
-      }
+   pgn->pos = pos + 1;
 
-      ASSERT(pgn->token_length>0&&pgn->token_length<=3);
-      pgn->token_string[pgn->token_length] = '\0';
+   if (truncated) {
 
-   } else {
+      pgn_line_column(pgn,pos,&line,&column);
+      my_log("pgn_read_token(): string too long at line %d, column %d\n",line,column);
 
-      // unknown token
+      // drop the rest of the string
 
-      // my_fatal("lexical error at line %d, column %d\n",pgn->char_line,pgn->char_column);
+      pgn->pos = pos;
+      if (!pgn_skip_to(pgn,'"')) {
+         pgn_line_column(pgn,pgn->size,&line,&column);
+         my_fatal("pgn_read_token(): EOF in string at line %d, column %d\n",line,column);
+      }
    }
 }
 
@@ -548,139 +1311,329 @@ static void pgn_read_token(pgn_t * pgn) {
 
 static void pgn_skip_blanks(pgn_t * pgn) {
 
+   int c;
+   int line, column;
+
    ASSERT(pgn!=NULL);
 
    while (true) {
 
-      pgn_char_read(pgn);
+      if (pgn->pos >= pgn->size && !pgn_fill(pgn,pgn->pos)) break;
+
+      c = (unsigned char) pgn->data[pgn->pos];
 
       if (false) {
 
-      } else if (isspace(pgn->char_hack)) {
+      } else if (isspace(c)) {
 
          // skip white space
 
-      } else if (pgn->char_hack == ';') {
+         pgn->pos++;
+
+      } else if (c == ';') {
 
          // skip comment to EOL
 
-         do {
+         if (!pgn_skip_to(pgn,'\n')) {
+            pgn_line_column(pgn,pgn->size,&line,&column);
+            my_fatal("pgn_skip_blanks(): EOF in comment at line %d, column %d\n",line,column);
+         }
 
-            pgn_char_read(pgn);
+      } else if (c == '%' && (pgn->pos == 0 || pgn->data[pgn->pos-1] == '\n')) {
 
-            if (pgn->char_hack == CHAR_EOF) {
-               my_fatal("pgn_skip_blanks(): EOF in comment at line %d, column %d\n",pgn->char_line,pgn->char_column);
-            }
+         // skip comment to EOL
 
-         } while (pgn->char_hack != '\n');
+         if (!pgn_skip_to(pgn,'\n')) {
+            pgn_line_column(pgn,pgn->size,&line,&column);
+            my_fatal("pgn_skip_blanks(): EOF in comment at line %d, column %d\n",line,column);
+         }
 
-      } else if (pgn->char_hack == '%' && pgn->char_column == 0) {
+      } else if (c == '{') {
 
-         // skip comment to EOL
+         // skip comment to next '}'
 
-         do {
+         if (!pgn_skip_to(pgn,'}')) {
+            pgn_line_column(pgn,pgn->size,&line,&column);
+            my_fatal("pgn_skip_blanks(): EOF in comment at line %d, column %d\n",line,column);
+         }
 
-            pgn_char_read(pgn);
+      } else { // not a white space
 
-            if (pgn->char_hack == CHAR_EOF) {
-               my_fatal("pgn_skip_blanks(): EOF in comment at line %d, column %d\n",pgn->char_line,pgn->char_column);
-            }
+         break;
+      }
+   }
+}
 
-         } while (pgn->char_hack != '\n');
+// pgn_skip_to()
 
-      } else if (pgn->char_hack == '{') {
+static bool pgn_skip_to(pgn_t * pgn, int c) {
 
-         // skip comment to next '}'
+   const char * p;
+   long int pos;
 
-         do {
+   ASSERT(pgn!=NULL);
+   ASSERT(pgn->pos<pgn->size);
 
-            pgn_char_read(pgn);
+   // skips past the next c, the current character doesn't count
 
-            if (pgn->char_hack == CHAR_EOF) {
-               my_fatal("pgn_skip_blanks(): EOF in comment at line %d, column %d\n",pgn->char_line,pgn->char_column);
-            }
+   pos = pgn->pos + 1;
 
-         } while (pgn->char_hack != '}');
+   while ((p = (const char *) memchr(&pgn->data[pos],c,pgn->size-pos)) == NULL) {
+      pos = pgn->size;
+      if (!pgn_fill(pgn,pos)) return false; // the skipped text isn't kept
+   }
 
-      } else { // not a white space
+   pgn->pos = (p - pgn->data) + 1;
 
-         break;
-      }
+   return true;
+}
+
+// pgn_skip_text()
+
+static void pgn_skip_text(pgn_t * pgn) {
+
+   long int start, pos, keep;
+
+   ASSERT(pgn!=NULL);
+
+   // jumps to the next character that can matter in ignored moves, the
+   // lexer takes over from there
+
+   start = pgn->pos;
+   pos = pgn->pos;
+
+   while ((pos = skip_scan(pgn->data,pos,pgn->size)) == pgn->size) {
+
+      // a symbol at the end of the data may go on in the next block
+
+      for (keep = pos; keep > start && is_symbol_next((unsigned char) pgn->data[keep-1]); keep--)
+         ;
+
+      start = keep;
+      if (!pgn_fill(pgn,keep)) break;
+   }
+
+   if (pos < pgn->size && (pgn->data[pos] == '-' || pgn->data[pos] == '/')) {
+
+      // possibly inside a result ("1-0", "0-1" or "1/2-1/2"), back up to the symbol start
+
+      while (pos > start && is_symbol_next((unsigned char) pgn->data[pos-1])) pos--;
    }
+
+   pgn->pos = pos;
 }
 
-// is_symbol_start()
+// skip_scan()
 
-static bool is_symbol_start(int c) {
+static long int skip_scan(const char data[], long int pos, long int end) {
+
+   ASSERT(data!=NULL);
+   ASSERT(pos>=0&&pos<=end);
+
+#if defined(__AVX2__)
+
+   int i;
+
+   __m256i stop[SkipStopNb];
+   for (i = 0; i < SkipStopNb; i++) stop[i] = _mm256_set1_epi8(SkipStop[i]);
+
+   while (pos + 32 <= end) {
+
+      __m256i chunk = _mm256_loadu_si256((const __m256i *) &data[pos]);
+      __m256i match = _mm256_cmpeq_epi8(chunk,stop[0]);
+      for (i = 1; i < SkipStopNb; i++) match = _mm256_or_si256(match,_mm256_cmpeq_epi8(chunk,stop[i]));
+
+      uint32 bits = uint32(_mm256_movemask_epi8(match));
+      if (bits != 0) return pos + __builtin_ctz(bits);
+
+      pos += 32;
+   }
+
+#elif defined(__SSE2__)
+
+   int i;
+   __m128i stop[SkipStopNb];
+   for (i = 0; i < SkipStopNb; i++) stop[i] = _mm_set1_epi8(SkipStop[i]);
+
+   while (pos + 16 <= end) {
 
-   return strchr("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",c) != NULL;
+      __m128i chunk = _mm_loadu_si128((const __m128i *) &data[pos]);
+      __m128i match = _mm_cmpeq_epi8(chunk,stop[0]);
+      for (i = 1; i < SkipStopNb; i++) match = _mm_or_si128(match,_mm_cmpeq_epi8(chunk,stop[i]));
+
+      uint32 bits = uint32(_mm_movemask_epi8(match));
+      if (bits != 0) return pos + __builtin_ctz(bits);
+
+      pos += 16;
+   }
+
+#endif
+
+   // scalar fallback and tail
+
+   for (; pos < end; pos++) {
+      if (is_skip_stop(data[pos])) return pos;
+   }
+
+   return end;
 }
 
-// is_symbol_next()
+// is_skip_stop()
 
-static bool is_symbol_next(int c) {
+static bool is_skip_stop(int c) {
 
-   return strchr("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_+#=:-/",c) != NULL;
+   switch (c) {
+   case '(': case ')': case '{': case ';': case '%': case '"': case '*': case '-': case '/': case '[':
+      return true;
+   default:
+      return false;
+   }
 }
 
-// pgn_char_read()
+// find_game()
 
-static void pgn_char_read(pgn_t * pgn) {
+static long int find_game(FILE * file, long int pos) {
 
-   ASSERT(pgn!=NULL);
+   int c;
+   long int line_pos;
+   bool tag_line, prev_tag_line;
 
-   // char "stack"
+   ASSERT(file!=NULL);
+   ASSERT(pos>=0);
 
-   if (pgn->char_unread) {
-      pgn->char_unread = false;
-      return;
+   // returns the offset of the first tag section that starts at or after pos
+
+   if (fseek(file,pos,SEEK_SET) == -1) {
+      my_fatal("find_game(): fseek(): %s\n",strerror(errno));
    }
 
-   // consume the current character
+   // skip the (partial) current line, we can't know what precedes it
 
-   if (pgn->char_first) {
+   do c = getc(file); while (c != EOF && c != '\n');
 
-      pgn->char_first = false;
+   prev_tag_line = true;
 
-   } else {
+   while (c != EOF) {
 
-      // update counters
+      line_pos = ftell(file);
 
-      ASSERT(pgn->char_hack!=CHAR_EOF);
+      c = getc(file);
+      tag_line = (c == '[');
 
-      if (false) {
-      } else if (pgn->char_hack == '\n') {
-         pgn->char_line++;
-         pgn->char_column = 0;
-      } else if (pgn->char_hack == '\t') {
-         pgn->char_column += TAB_SIZE - (pgn->char_column % TAB_SIZE);
+      if (tag_line) {
+         c = getc(file);
+         if (!prev_tag_line && isalpha(c)) return line_pos;
+      }
+
+      while (c != EOF && c != '\n') c = getc(file);
+
+      prev_tag_line = tag_line;
+   }
+
+   return ftell(file);
+}
+
+// is_game_start()
+
+static bool is_game_start(FILE * file, long int pos) {
+
+   ASSERT(file!=NULL);
+   ASSERT(pos>=0);
+
+   // cheap check that an indexed offset still points at a tag section
+
+   if (fseek(file,pos,SEEK_SET) == -1) {
+      my_fatal("is_game_start(): fseek(): %s\n",strerror(errno));
+   }
+
+   return getc(file) == '[';
+}
+
+// is_game_complete()
+
+static bool is_game_complete(const char text[], long int size) {
+
+   long int pos, start;
+   int depth;
+   bool result;
+
+   ASSERT(text!=NULL);
+   ASSERT(size>=0);
+
+   // the movetext must end with a result, outside comments and variations
+
+   pos = 0;
+
+   while (pos < size) { // tag section
+
+      if (isspace((unsigned char) text[pos])) {
+         pos++;
+      } else if (text[pos] == '[') {
+         while (pos < size && text[pos] != '\n') pos++;
       } else {
-         pgn->char_column++;
+         break;
       }
    }
 
-   // read a new character
+   depth = 0;
+   result = false;
+
+   while (pos < size) {
+
+      if (false) {
+
+      } else if (text[pos] == '{') {
+
+         while (pos < size && text[pos] != '}') pos++;
+         if (pos >= size) return false;
+         pos++;
+
+      } else if (text[pos] == ';' || (text[pos] == '%' && (pos == 0 || text[pos-1] == '\n'))) {
+
+         while (pos < size && text[pos] != '\n') pos++;
 
-   pgn->char_hack = fgetc(pgn->file);
+      } else if (text[pos] == '(' || text[pos] == ')') {
 
-   if (pgn->char_hack == EOF) {
-      if (ferror(pgn->file)) my_fatal("pgn_char_read(): fgetc(): %s\n",strerror(errno));
-      pgn->char_hack = TOKEN_EOF;
+         depth += (text[pos] == '(') ? +1 : -1;
+         result = false;
+         pos++;
+
+      } else if (text[pos] == '*') {
+
+         result = depth == 0;
+         pos++;
+
+      } else if (is_symbol_start(text[pos])) {
+
+         start = pos;
+         while (pos < size && is_symbol_next(text[pos])) pos++;
+
+         result = depth == 0
+               && ((pos - start == 3 && (strncmp(&text[start],"1-0",3) == 0 || strncmp(&text[start],"0-1",3) == 0))
+                || (pos - start == 7 && strncmp(&text[start],"1/2-1/2",7) == 0));
+
+      } else {
+
+         if (!isspace((unsigned char) text[pos])) result = false;
+         pos++;
+      }
    }
 
-   if (DispChar) printf("< L%d C%d '%c' (%02X)\n",pgn->char_line,pgn->char_column,pgn->char_hack,pgn->char_hack);
+   return result;
 }
 
-// pgn_char_unread()
+// is_symbol_start()
 
-static void pgn_char_unread(pgn_t * pgn) {
+static bool is_symbol_start(int c) {
 
-   ASSERT(pgn!=NULL);
+   return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9');
+}
+
+// is_symbol_next()
 
-   ASSERT(!pgn->char_unread);
-   ASSERT(!pgn->char_first);
+static bool is_symbol_next(int c) {
 
-   pgn->char_unread = true;
+   return is_symbol_start(c) || (c != '\0' && strchr("_+#=:-/",c) != NULL);
 }
 
 // end of pgn.cpp
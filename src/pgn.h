@@ -14,54 +14,90 @@
 
 const int PGN_STRING_SIZE = 256;
 
+// tags looked up by pgn_tag(), any other tag is found with pgn_tag_find()
+
+enum tag_t {
+   TAG_EVENT,
+   TAG_SITE,
+   TAG_DATE,
+   TAG_WHITE,
+   TAG_BLACK,
+   TAG_RESULT,
+   TAG_WHITE_ELO,
+   TAG_BLACK_ELO,
+   TAG_ECO,
+   TAG_FEN,
+   TAG_PLY_COUNT,
+   TAG_EVENT_DATE,
+   TAG_EVENT_TYPE,
+   TAG_NB
+};
+
 // types
 
+struct pgn_tag_t {
+   int name; // offsets into pgn_t::tag_text, NUL-terminated
+   int value;
+};
+
 struct pgn_t {
 
-   FILE * file;
+   const char * data; // indexed by file position, see pgn_fill()
+   long int size; // bytes read so far, the file size once it is done
+   long int pos;
+   bool mapped;
+
+   char * buffer; // the whole file without mmap(), a window of a compressed one
+   long int buffer_size;
+   long int base; // file position of buffer[0]
+   int base_line; // line number at base
+   int fd; // decompressor output, -1 once everything is in memory
+   int pid;
 
-   int char_hack;
-   int char_line;
-   int char_column;
-   bool char_unread;
-   bool char_first;
+   long int line_pos; // see pgn_line_column()
+   int line_nb;
 
    int token_type;
-   char token_string[PGN_STRING_SIZE];
+   const char * token_string; // not NUL-terminated
    int token_length;
-   int token_line;
-   int token_column;
+   long int token_pos;
    bool token_unread;
    bool token_first;
+   char token_buffer[PGN_STRING_SIZE]; // strings with escapes
    
    long int last_stream_pos;
+   long int stop_pos;
 
-   char result[PGN_STRING_SIZE];
-   char fen[PGN_STRING_SIZE];
-   char white[PGN_STRING_SIZE];
-   char whiteelo[PGN_STRING_SIZE];
-   char black[PGN_STRING_SIZE];
-   char blackelo[PGN_STRING_SIZE];
-   char date[PGN_STRING_SIZE];
-   char event[PGN_STRING_SIZE];
-   char site[PGN_STRING_SIZE];
-   char eco[PGN_STRING_SIZE];
-   
-   char plycount[PGN_STRING_SIZE];
-   char eventdate[PGN_STRING_SIZE];
-   char eventtype[PGN_STRING_SIZE];
+   char * tag_text; // arena for the tags of the current game
+   int tag_text_size;
+   int tag_text_alloc;
+   pgn_tag_t * tag; // in file order
+   int tag_nb;
+   int tag_alloc;
+   int tag_index[TAG_NB]; // into tag[], -1 if missing
 
-   int move_line;
-   int move_column;
+   long int move_pos;
 };
 
 // functions
 
-extern void pgn_open      (pgn_t * pgn, const char file_name[]);
-extern void pgn_close     (pgn_t * pgn);
+extern void pgn_open       (pgn_t * pgn, const char file_name[]);
+extern void pgn_open_range (pgn_t * pgn, const char file_name[], long int start_pos, long int stop_pos);
+extern void pgn_close      (pgn_t * pgn);
+
+extern bool pgn_is_compressed (const char file_name[]);
+
+extern long int pgn_tell   (const pgn_t * pgn);
+extern void pgn_line_column (pgn_t * pgn, long int pos, int * line, int * column);
+
+extern int  pgn_split      (const char file_name[], long int start_pos, long int stop_pos, long int pos[], int n);
+extern long int pgn_complete_size (const char file_name[], long int start_pos);
 
-extern bool pgn_next_game (pgn_t * pgn);
-extern bool pgn_next_move (pgn_t * pgn, char string[], int size);
+extern bool pgn_next_game  (pgn_t * pgn);
+extern const char * pgn_tag      (const pgn_t * pgn, int tag);
+extern const char * pgn_tag_find (const pgn_t * pgn, const char name[]);
+extern bool pgn_next_move  (pgn_t * pgn, char string[], int size);
+extern void pgn_skip_game  (pgn_t * pgn);
 
 #endif // !defined PGN_H
 
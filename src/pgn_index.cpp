@@ -0,0 +1,395 @@
+
+// pgn_index.cpp
+
+// includes
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "pgn.h"
+#include "pgn_index.h"
+#include "util.h"
+
+// constants
+
+static const int PgiVersion = 1;
+
+static const int PgiHeaderSize = 16; // version, game count, PGN size
+static const int PgiGameSize = 20; // offset, length, digest
+
+static const int BufferSize = 1 << 20;
+
+// prototypes
+
+static void   pgi_build     (const char pgn_file_name[], const char pgi_file_name[]);
+static void   pgi_print     (const char pgn_file_name[], int game_nb);
+
+static void   pgi_name      (char name[], const char pgn_file_name[]);
+
+static uint64 header_digest (const pgn_t * pgn, long int pos);
+
+static uint64 read_integer  (FILE * file, int size);
+static void   write_integer (FILE * file, int size, uint64 n);
+
+// functions
+
+// pgn_index()
+
+void pgn_index(int argc, char * argv[]) {
+
+   int i;
+   const char * pgn_file;
+   int game_nb;
+   char pgi_file[4096];
+
+   pgn_file = NULL;
+   my_string_set(&pgn_file,"book.pgn");
+
+   game_nb = -1;
+
+   for (i = 1; i < argc; i++) {
+
+      if (false) {
+
+      } else if (my_string_equal(argv[i],"pgn-index")) {
+
+         // skip
+
+      } else if (my_string_equal(argv[i],"-pgn")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("pgn_index(): missing argument\n");
+
+         my_string_set(&pgn_file,argv[i]);
+
+      } else if (my_string_equal(argv[i],"-game")) {
+
+         i++;
+         if (argv[i] == NULL) my_fatal("pgn_index(): missing argument\n");
+
+         game_nb = atoi(argv[i]);
+         if (game_nb < 0) my_fatal("pgn_index(): -game must be positive or zero\n");
+
+      } else {
+
+         my_fatal("pgn_index(): unknown option \"%s\"\n",argv[i]);
+      }
+   }
+
+   if (game_nb >= 0) {
+      pgi_print(pgn_file,game_nb);
+   } else {
+      pgi_name(pgi_file,pgn_file);
+      pgi_build(pgn_file,pgi_file);
+   }
+}
+
+// pgi_open()
+
+bool pgi_open(pgi_t * pgi, const char pgn_file_name[]) {
+
+   char name[4096];
+   FILE * file;
+   FILE * pgn_file;
+   long int pgn_size;
+   int i;
+
+   ASSERT(pgi!=NULL);
+   ASSERT(pgn_file_name!=NULL);
+
+   // returns false if there is no usable sidecar, the caller scans the file instead
+
+   pgi->size = 0;
+   pgi->pgn_size = 0;
+   pgi->game = NULL;
+
+   pgi_name(name,pgn_file_name);
+
+   file = fopen(name,"rb");
+   if (file == NULL) return false;
+
+   setvbuf(file,NULL,_IOFBF,BufferSize);
+
+   if (read_integer(file,4) != uint64(PgiVersion)) {
+      printf("ignoring \"%s\", built by another version\n",name);
+      fclose(file);
+      return false;
+   }
+
+   pgi->size = read_integer(file,4);
+   pgi->pgn_size = read_integer(file,8);
+
+   // a PGN file that only grew at its end keeps its old games
+
+   pgn_file = fopen(pgn_file_name,"rb");
+   if (pgn_file == NULL) my_fatal("pgi_open(): can't open file \"%s\": %s\n",pgn_file_name,strerror(errno));
+
+   if (fseek(pgn_file,0,SEEK_END) == -1) {
+      my_fatal("pgi_open(): fseek(): %s\n",strerror(errno));
+   }
+
+   pgn_size = ftell(pgn_file);
+   fclose(pgn_file);
+
+   if (pgn_size < pgi->pgn_size) {
+      printf("ignoring \"%s\", the PGN file is shorter than when it was indexed\n",name);
+      fclose(file);
+      return false;
+   }
+
+   pgi->game = (pgi_game_t *) my_malloc(sizeof(pgi_game_t)*(pgi->size+1));
+
+   for (i = 0; i < pgi->size; i++) {
+      pgi->game[i].pos = read_integer(file,8);
+      pgi->game[i].length = read_integer(file,4);
+      pgi->game[i].digest = read_integer(file,8);
+   }
+
+   fclose(file);
+
+   return true;
+}
+
+// pgi_close()
+
+void pgi_close(pgi_t * pgi) {
+
+   ASSERT(pgi!=NULL);
+
+   if (pgi->game != NULL) my_free(pgi->game);
+
+   pgi->size = 0;
+   pgi->game = NULL;
+}
+
+// pgi_find()
+
+int pgi_find(const pgi_t * pgi, long int pos) {
+
+   int left, right, middle;
+
+   ASSERT(pgi!=NULL);
+   ASSERT(pos>=0);
+
+   // returns the first game that starts at or after pos, or pgi->size
+
+   left = 0;
+   right = pgi->size;
+
+   while (left < right) {
+
+      middle = left + (right - left) / 2;
+
+      if (pgi->game[middle].pos < pos) {
+         left = middle + 1;
+      } else {
+         right = middle;
+      }
+   }
+
+   return left;
+}
+
+// pgi_build()
+
+static void pgi_build(const char pgn_file_name[], const char pgi_file_name[]) {
+
+   pgn_t pgn[1];
+   char tmp_name[4096+4];
+   FILE * file;
+   int game_nb;
+   long int pos, prev_pos;
+   uint64 digest, prev_digest;
+
+   ASSERT(pgn_file_name!=NULL);
+   ASSERT(pgi_file_name!=NULL);
+
+   if (pgn_is_compressed(pgn_file_name)) {
+      my_fatal("pgi_build(): \"%s\" is compressed, its games can't be reached by offset\n",pgn_file_name);
+   }
+
+   sprintf(tmp_name,"%.4000s.tmp",pgi_file_name);
+
+   file = fopen(tmp_name,"wb");
+   if (file == NULL) my_fatal("pgi_build(): can't open file \"%s\": %s\n",tmp_name,strerror(errno));
+
+   setvbuf(file,NULL,_IOFBF,BufferSize);
+
+   pgn_open(pgn,pgn_file_name);
+
+   // header, the game count is patched at the end
+
+   write_integer(file,4,PgiVersion);
+   write_integer(file,4,0);
+   write_integer(file,8,pgn->size);
+
+   printf("indexing games ...\n");
+
+   game_nb = 0;
+   prev_pos = 0;
+   prev_digest = 0;
+
+   while (pgn_next_game(pgn)) {
+
+      // the first move token is pending after the tag section
+
+      pos = (pgn->last_stream_pos != -1) ? pgn->last_stream_pos - 1 : pgn->token_pos;
+      digest = header_digest(pgn,pos);
+
+      // a game extends to the start of the next one
+
+      if (game_nb > 0) {
+         write_integer(file,8,prev_pos);
+         write_integer(file,4,pos-prev_pos);
+         write_integer(file,8,prev_digest);
+      }
+
+      pgn_skip_game(pgn);
+
+      prev_pos = pos;
+      prev_digest = digest;
+
+      game_nb++;
+      if (game_nb % 100000 == 0) printf("%d games ...\n",game_nb);
+   }
+
+   if (game_nb > 0) {
+      write_integer(file,8,prev_pos);
+      write_integer(file,4,pgn->size-prev_pos);
+      write_integer(file,8,prev_digest);
+   }
+
+   ASSERT(ftell(file)==PgiHeaderSize+long(game_nb)*PgiGameSize);
+
+   if (fseek(file,4,SEEK_SET) == -1) my_fatal("pgi_build(): fseek(): %s\n",strerror(errno));
+   write_integer(file,4,game_nb);
+
+   if (fclose(file) == EOF) my_fatal("pgi_build(): fclose(): %s\n",strerror(errno));
+
+   if (rename(tmp_name,pgi_file_name) != 0) {
+      my_fatal("pgi_build(): can't rename \"%s\" to \"%s\": %s\n",tmp_name,pgi_file_name,strerror(errno));
+   }
+
+   pgn_close(pgn);
+
+   printf("%d game%s indexed in \"%s\".\n",game_nb,(game_nb>1)?"s":"",pgi_file_name);
+}
+
+// pgi_print()
+
+static void pgi_print(const char pgn_file_name[], int game_nb) {
+
+   pgi_t pgi[1];
+   pgn_t pgn[1];
+   const pgi_game_t * game;
+
+   ASSERT(pgn_file_name!=NULL);
+   ASSERT(game_nb>=0);
+
+   if (!pgi_open(pgi,pgn_file_name)) {
+      my_fatal("pgi_print(): \"%s\" is not indexed, run pgn-index first\n",pgn_file_name);
+   }
+
+   if (game_nb >= pgi->size) my_fatal("pgi_print(): no game %d, %d games indexed\n",game_nb,pgi->size);
+
+   game = &pgi->game[game_nb];
+
+   // jump to the game and check its tags, in case the file was rewritten
+
+   pgn_open_range(pgn,pgn_file_name,game->pos,-1);
+
+   if (!pgn_next_game(pgn) || header_digest(pgn,game->pos) != game->digest) {
+      my_fatal("pgi_print(): game %d doesn't match the index, run pgn-index again\n",game_nb);
+   }
+
+   fwrite(&pgn->data[game->pos],1,game->length,stdout);
+
+   pgn_close(pgn);
+   pgi_close(pgi);
+}
+
+// pgi_name()
+
+static void pgi_name(char name[], const char pgn_file_name[]) {
+
+   ASSERT(name!=NULL);
+   ASSERT(pgn_file_name!=NULL);
+
+   sprintf(name,"%.4000s.pgi",pgn_file_name);
+}
+
+// header_digest()
+
+static uint64 header_digest(const pgn_t * pgn, long int pos) {
+
+   uint64 digest;
+   long int i;
+
+   ASSERT(pgn!=NULL);
+   ASSERT(pos>=0&&pos<=pgn->token_pos);
+
+   // FNV-1a of the tag section, up to the first move token
+
+   digest = U64(0xCBF29CE484222325);
+
+   for (i = pos; i < pgn->token_pos; i++) {
+      digest = (digest ^ (unsigned char) pgn->data[i]) * U64(0x100000001B3);
+   }
+
+   return digest;
+}
+
+// read_integer()
+
+static uint64 read_integer(FILE * file, int size) {
+
+   uint64 n;
+   int i;
+   int b;
+
+   ASSERT(file!=NULL);
+   ASSERT(size>0&&size<=8);
+
+   n = 0;
+
+   for (i = 0; i < size; i++) {
+
+      b = fgetc(file);
+
+      if (b == EOF) {
+         if (feof(file)) {
+            my_fatal("read_integer(): fgetc(): EOF reached\n");
+         } else { // error
+            my_fatal("read_integer(): fgetc(): %s\n",strerror(errno));
+         }
+      }
+
+      ASSERT(b>=0&&b<256);
+      n = (n << 8) | b;
+   }
+
+   return n;
+}
+
+// write_integer()
+
+static void write_integer(FILE * file, int size, uint64 n) {
+
+   int i;
+   int b;
+
+   ASSERT(file!=NULL);
+   ASSERT(size>0&&size<=8);
+   ASSERT(size==8||n>>(size*8)==0);
+
+   for (i = size-1; i >= 0; i--) {
+      b = (n >> (i*8)) & 0xFF;
+      ASSERT(b>=0&&b<256);
+      fputc(b,file);
+   }
+}
+
+// end of pgn_index.cpp
+
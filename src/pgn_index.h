@@ -0,0 +1,37 @@
+
+// pgn_index.h
+
+#ifndef PGN_INDEX_H
+#define PGN_INDEX_H
+
+// includes
+
+#include "util.h"
+
+// types
+
+struct pgi_game_t {
+   long int pos; // of the first '['
+   int length; // up to the next game
+   uint64 digest; // of the tag section
+};
+
+struct pgi_t {
+   int size; // games
+   long int pgn_size; // of the PGN file when it was indexed
+   pgi_game_t * game;
+};
+
+// functions
+
+extern void pgn_index (int argc, char * argv[]);
+
+extern bool pgi_open  (pgi_t * pgi, const char pgn_file_name[]);
+extern void pgi_close (pgi_t * pgi);
+
+extern int  pgi_find  (const pgi_t * pgi, long int pos);
+
+#endif // !defined PGN_INDEX_H
+
+// end of pgn_index.h
+
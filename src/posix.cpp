@@ -72,6 +72,67 @@ double now_cpu() {
    return duration(&ru->ru_utime);
 }
 
+// now_thread_cpu()
+
+double now_thread_cpu() {
+
+   struct timespec ts[1];
+
+   // CPU time of the calling thread only, now_cpu() counts the whole process
+
+   if (clock_gettime(CLOCK_THREAD_CPUTIME_ID,ts) == -1) {
+      my_fatal("now_thread_cpu(): clock_gettime(): %s\n",strerror(errno));
+   }
+
+   return ts->tv_sec + ts->tv_nsec * 1E-9;
+}
+
+// peak_memory()
+
+double peak_memory() {
+
+   struct rusage ru[1];
+
+   if (getrusage(RUSAGE_SELF,ru) == -1) {
+      my_fatal("peak_memory(): getrusage(): %s\n",strerror(errno));
+   }
+
+   // largest resident set so far, in bytes
+
+#if defined(__APPLE__)
+   return double(ru->ru_maxrss);
+#else
+   return double(ru->ru_maxrss) * 1024.0; // kilobytes
+#endif
+}
+
+// cpu_nb()
+
+int cpu_nb() {
+
+   long int n;
+
+   // processors online, 1 if the system won't tell
+
+   n = sysconf(_SC_NPROCESSORS_ONLN);
+
+   return (n >= 1) ? int(n) : 1;
+}
+
+// file_max()
+
+int file_max() {
+
+   struct rlimit limit[1];
+
+   // open files allowed to the process (soft limit), 1024 if the system won't tell
+
+   if (getrlimit(RLIMIT_NOFILE,limit) == -1 || limit->rlim_cur == RLIM_INFINITY) return 1024;
+   if (limit->rlim_cur > 1 << 20) return 1 << 20;
+
+   return int(limit->rlim_cur);
+}
+
 // duration()
 
 static double duration(const struct timeval *tv) {
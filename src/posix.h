@@ -14,6 +14,12 @@ extern bool   input_available ();
 
 extern double now_real        ();
 extern double now_cpu         ();
+extern double now_thread_cpu  ();
+
+extern double peak_memory     ();
+
+extern int    cpu_nb          ();
+extern int    file_max        ();
 
 #endif // !defined POSIX_H
 
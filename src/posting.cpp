@@ -0,0 +1,212 @@
+
+// posting.cpp
+
+// game id lists for make-book: the first id is kept inline, the following
+// ones are appended as varint deltas to a chain of chunks taken from a pool
+
+// includes
+
+#include "posting.h"
+#include "util.h"
+
+// constants
+
+static const uint32 ChunkNone = 0;
+
+// prototypes
+
+static uint32 chunk_alloc (posting_pool_t * pool);
+static void   chunk_put   (posting_pool_t * pool, posting_t * list, int b);
+
+// functions
+
+// posting_pool_init()
+
+void posting_pool_init(posting_pool_t * pool) {
+
+   ASSERT(pool!=NULL);
+
+   pool->size = 1; // chunk 0 is ChunkNone
+   pool->alloc = 256;
+   pool->chunk = (posting_chunk_t *) my_malloc(pool->alloc*sizeof(posting_chunk_t));
+}
+
+// posting_pool_free()
+
+void posting_pool_free(posting_pool_t * pool) {
+
+   ASSERT(pool!=NULL);
+
+   my_free(pool->chunk);
+
+   pool->chunk = NULL;
+   pool->size = 0;
+   pool->alloc = 0;
+}
+
+// posting_clear()
+
+void posting_clear(posting_t * list) {
+
+   ASSERT(list!=NULL);
+
+   list->first = -1;
+   list->last = -1;
+   list->head = ChunkNone;
+   list->tail = ChunkNone;
+}
+
+// posting_add()
+
+void posting_add(posting_pool_t * pool, posting_t * list, int game) {
+
+   uint32 delta;
+
+   ASSERT(pool!=NULL);
+   ASSERT(list!=NULL);
+   ASSERT(game>=0);
+
+   if (list->first == -1) {
+      list->first = game;
+      list->last = game;
+      return;
+   }
+
+   // ids arrive in game order, a repeated id is the same game again
+
+   ASSERT(game>=list->last);
+   if (game <= list->last) return;
+
+   delta = game - list->last;
+   list->last = game;
+
+   while (delta >= 0x80) {
+      chunk_put(pool,list,(delta&0x7F)|0x80);
+      delta >>= 7;
+   }
+
+   chunk_put(pool,list,delta);
+}
+
+// posting_iter_init()
+
+void posting_iter_init(posting_iter_t * iter, const posting_pool_t * pool, const posting_t * list) {
+
+   ASSERT(iter!=NULL);
+   ASSERT(pool!=NULL);
+   ASSERT(list!=NULL);
+
+   iter->pool = pool;
+   iter->list = list;
+   iter->chunk = ChunkNone;
+   iter->pos = 0;
+   iter->game = -1;
+}
+
+// posting_iter_next()
+
+bool posting_iter_next(posting_iter_t * iter, int * game) {
+
+   const posting_chunk_t * chunk;
+   uint32 delta;
+   int shift;
+   int b;
+
+   ASSERT(iter!=NULL);
+   ASSERT(game!=NULL);
+
+   if (iter->game == -1) {
+
+      // first id, inline
+
+      if (iter->list->first == -1) return false;
+
+      iter->game = iter->list->first;
+      iter->chunk = iter->list->head;
+      iter->pos = 0;
+
+      *game = iter->game;
+      return true;
+   }
+
+   if (iter->game == iter->list->last) return false;
+
+   // decode one varint, it may straddle chunks
+
+   delta = 0;
+   shift = 0;
+
+   while (true) {
+
+      ASSERT(iter->chunk!=ChunkNone);
+      chunk = &iter->pool->chunk[iter->chunk];
+
+      if (iter->pos >= chunk->size) {
+         iter->chunk = chunk->next;
+         iter->pos = 0;
+         continue;
+      }
+
+      b = chunk->data[iter->pos++];
+      delta |= uint32(b & 0x7F) << shift;
+      shift += 7;
+
+      if ((b & 0x80) == 0) break;
+   }
+
+   iter->game += delta;
+
+   *game = iter->game;
+   return true;
+}
+
+// chunk_alloc()
+
+static uint32 chunk_alloc(posting_pool_t * pool) {
+
+   uint32 index;
+
+   ASSERT(pool!=NULL);
+
+   if (pool->size == pool->alloc) {
+      pool->alloc *= 2;
+      pool->chunk = (posting_chunk_t *) my_realloc(pool->chunk,pool->alloc*sizeof(posting_chunk_t));
+   }
+
+   index = pool->size++;
+
+   pool->chunk[index].next = ChunkNone;
+   pool->chunk[index].size = 0;
+
+   return index;
+}
+
+// chunk_put()
+
+static void chunk_put(posting_pool_t * pool, posting_t * list, int b) {
+
+   uint32 index;
+   posting_chunk_t * chunk;
+
+   ASSERT(pool!=NULL);
+   ASSERT(list!=NULL);
+   ASSERT(b>=0&&b<256);
+
+   if (list->tail == ChunkNone || pool->chunk[list->tail].size == PostingChunkSize) {
+
+      index = chunk_alloc(pool); // may move pool->chunk
+
+      if (list->tail == ChunkNone) {
+         list->head = index;
+      } else {
+         pool->chunk[list->tail].next = index;
+      }
+
+      list->tail = index;
+   }
+
+   chunk = &pool->chunk[list->tail];
+   chunk->data[chunk->size++] = b;
+}
+
+// end of posting.cpp
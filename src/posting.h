@@ -0,0 +1,57 @@
+
+// posting.h
+
+#ifndef POSTING_H
+#define POSTING_H
+
+// includes
+
+#include "util.h"
+
+// constants
+
+const int PostingChunkSize = 27; // makes a chunk 32 bytes
+
+// types
+
+struct posting_t {
+   sint32 first;
+   sint32 last;
+   uint32 head;
+   uint32 tail;
+};
+
+struct posting_chunk_t {
+   uint32 next;
+   uint8 size;
+   uint8 data[PostingChunkSize];
+};
+
+struct posting_pool_t {
+   int size;
+   int alloc;
+   posting_chunk_t * chunk;
+};
+
+struct posting_iter_t {
+   const posting_pool_t * pool;
+   const posting_t * list;
+   uint32 chunk;
+   int pos;
+   sint32 game;
+};
+
+// functions
+
+extern void posting_pool_init  (posting_pool_t * pool);
+extern void posting_pool_free  (posting_pool_t * pool);
+
+extern void posting_clear      (posting_t * list);
+extern void posting_add        (posting_pool_t * pool, posting_t * list, int game);
+
+extern void posting_iter_init  (posting_iter_t * iter, const posting_pool_t * pool, const posting_t * list);
+extern bool posting_iter_next  (posting_iter_t * iter, int * game);
+
+#endif // !defined POSTING_H
+
+// end of posting.h
@@ -0,0 +1,204 @@
+
+// radix.cpp
+
+// LSD radix sort of (key,low) pairs, one byte per pass, low bytes first;
+// each pass is a histogram then a stable scatter, split between threads
+
+// includes
+
+#include <cerrno>
+#include <cstring>
+
+#include <pthread.h>
+
+#include "radix.h"
+#include "util.h"
+
+// constants
+
+static const int DigitNb = 12; // 4 bytes of low, then 8 bytes of key
+static const int ThreadMax = 64;
+
+// types
+
+struct radix_job_t {
+   pthread_t thread;
+   const radix_pair_t * src;
+   radix_pair_t * dst;
+   int begin;
+   int end;
+   int digit;
+   bool scatter;
+   int count[256]; // histogram, then the first destination of each bucket
+};
+
+// prototypes
+
+static void   radix_pass (radix_job_t job[], int threads);
+static void * radix_loop (void * arg);
+static int    digit_of   (const radix_pair_t * pair, int digit);
+
+// functions
+
+// radix_sort()
+
+void radix_sort(radix_pair_t pair[], int size, int threads) {
+
+   radix_job_t job[ThreadMax];
+   radix_pair_t * tmp;
+   radix_pair_t * src, * dst, * swap;
+   int count[DigitNb][256];
+   int digit;
+   int pos;
+   int b, t;
+   int sum;
+
+   ASSERT(pair!=NULL||size==0);
+   ASSERT(size>=0);
+   ASSERT(threads>=1);
+
+   if (size < 2) return;
+
+   if (threads > ThreadMax) threads = ThreadMax;
+   if (threads > size) threads = size;
+
+   // the digit histograms don't depend on the order, count them once to
+   // skip the passes where every pair has the same byte
+
+   memset(count,0,sizeof(count));
+
+   for (pos = 0; pos < size; pos++) {
+      for (digit = 0; digit < DigitNb; digit++) {
+         count[digit][digit_of(&pair[pos],digit)]++;
+      }
+   }
+
+   tmp = (radix_pair_t *) my_malloc(size*sizeof(radix_pair_t));
+
+   src = pair;
+   dst = tmp;
+
+   for (t = 0; t < threads; t++) {
+      job[t].begin = int((double(size) * t) / threads);
+      job[t].end = int((double(size) * (t+1)) / threads);
+   }
+
+   for (digit = 0; digit < DigitNb; digit++) {
+
+      for (b = 0; b < 256; b++) {
+         if (count[digit][b] != 0) break;
+      }
+
+      if (count[digit][b] == size) continue; // nothing to do
+
+      // per-thread histograms
+
+      for (t = 0; t < threads; t++) {
+         job[t].src = src;
+         job[t].dst = dst;
+         job[t].digit = digit;
+         job[t].scatter = false;
+      }
+
+      radix_pass(job,threads);
+
+      // bucket b of thread t goes after bucket b of the threads before it,
+      // which keeps the scatter stable
+
+      sum = 0;
+
+      for (b = 0; b < 256; b++) {
+         for (t = 0; t < threads; t++) {
+            pos = job[t].count[b];
+            job[t].count[b] = sum;
+            sum += pos;
+         }
+      }
+
+      ASSERT(sum==size);
+
+      for (t = 0; t < threads; t++) job[t].scatter = true;
+
+      radix_pass(job,threads);
+
+      swap = src;
+      src = dst;
+      dst = swap;
+   }
+
+   if (src != pair) memcpy(pair,src,size*sizeof(radix_pair_t));
+
+   my_free(tmp);
+}
+
+// radix_pass()
+
+static void radix_pass(radix_job_t job[], int threads) {
+
+   int t;
+
+   ASSERT(job!=NULL);
+   ASSERT(threads>=1&&threads<=ThreadMax);
+
+   if (threads == 1) {
+      radix_loop(&job[0]);
+      return;
+   }
+
+   for (t = 0; t < threads; t++) {
+      if (pthread_create(&job[t].thread,NULL,&radix_loop,&job[t]) != 0) {
+         my_fatal("radix_pass(): pthread_create(): %s\n",strerror(errno));
+      }
+   }
+
+   for (t = 0; t < threads; t++) {
+      if (pthread_join(job[t].thread,NULL) != 0) {
+         my_fatal("radix_pass(): pthread_join(): %s\n",strerror(errno));
+      }
+   }
+}
+
+// radix_loop()
+
+static void * radix_loop(void * arg) {
+
+   radix_job_t * job;
+   int pos;
+
+   job = (radix_job_t *) arg;
+   ASSERT(job!=NULL);
+
+   if (job->scatter) {
+
+      for (pos = job->begin; pos < job->end; pos++) {
+         job->dst[job->count[digit_of(&job->src[pos],job->digit)]++] = job->src[pos];
+      }
+
+   } else {
+
+      memset(job->count,0,sizeof(job->count));
+
+      for (pos = job->begin; pos < job->end; pos++) {
+         job->count[digit_of(&job->src[pos],job->digit)]++;
+      }
+   }
+
+   return NULL;
+}
+
+// digit_of()
+
+static int digit_of(const radix_pair_t * pair, int digit) {
+
+   ASSERT(pair!=NULL);
+   ASSERT(digit>=0&&digit<DigitNb);
+
+   if (digit < 4) {
+      return (pair->low >> (digit * 8)) & 0xFF;
+   } else {
+      return int((pair->key >> ((digit - 4) * 8)) & 0xFF);
+   }
+}
+
+// end of radix.cpp
+
@@ -0,0 +1,26 @@
+
+// radix.h
+
+#ifndef RADIX_H
+#define RADIX_H
+
+// includes
+
+#include "util.h"
+
+// types
+
+struct radix_pair_t {
+   uint64 key;
+   uint32 low; // secondary key
+   uint32 index;
+};
+
+// functions
+
+extern void radix_sort (radix_pair_t pair[], int size, int threads);
+
+#endif // !defined RADIX_H
+
+// end of radix.h
+
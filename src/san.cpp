@@ -32,10 +32,13 @@ enum ambiguity_t {
 
 // functions
 
-static bool san_to_lan    (const char san[], const board_t * board, char string[], int size);
-static int  move_from_lan (const char string[], const board_t * board);
+static bool san_to_lan          (const char san[], const board_t * board, char string[], int size);
+static int  move_from_lan       (const char string[], const board_t * board);
+static int  move_from_lan_legal (const char string[], const board_t * board);
 
-static int  ambiguity     (int move, const board_t * board);
+static bool from_is_ok          (const char string[], const board_t * board, int from, int to);
+
+static int  ambiguity           (int move, const board_t * board);
 
 // move_to_san()
 
@@ -163,6 +166,26 @@ int move_from_san(const char string[], const board_t * board) {
    return move;
 }
 
+// move_from_san_legal()
+
+int move_from_san_legal(const char string[], const board_t * board) {
+
+   char s[256];
+   int move;
+
+   ASSERT(string!=NULL);
+   ASSERT(board_is_ok(board));
+
+   // same as move_from_san() followed by move_is_legal(), without generating moves
+
+   san_to_lan(string,board,s,256);
+   move = move_from_lan_legal(s,board);
+
+   ASSERT(move==MoveNone||move_is_legal(move,board));
+
+   return move;
+}
+
 // move_from_san_debug()
 
 int move_from_san_debug(const char string[], const board_t * board) {
@@ -503,6 +526,190 @@ static int move_from_lan(const char string[], const board_t * board) {
    return move;
 }
 
+// move_from_lan_legal()
+
+static int move_from_lan_legal(const char string[], const board_t * board) {
+
+   int move;
+   int promote;
+   char s[256];
+   int from, to;
+   int colour;
+   int inc;
+   const sint8 * ptr_inc;
+   int piece, capture;
+   int sq;
+   int n;
+
+   ASSERT(string!=NULL);
+   ASSERT(board_is_ok(board));
+
+   // init
+
+   if (strlen(string) != 7) return MoveNone;
+
+   colour = board->turn;
+
+   // castling and known from square are rare, check them the slow way
+
+   if (string[1] != '?' && string[2] != '?') {
+      move = move_from_lan(string,board);
+      if (move != MoveNone && !move_is_legal(move,board)) move = MoveNone;
+      return move;
+   }
+
+   // promote
+
+   promote = 0;
+
+   switch (string[6]) {
+   case '?': // not a promotion
+      break;
+   case 'N':
+      promote = MovePromoteKnight;
+      break;
+   case 'B':
+      promote = MovePromoteBishop;
+      break;
+   case 'R':
+      promote = MovePromoteRook;
+      break;
+   case 'Q':
+      promote = MovePromoteQueen;
+      break;
+   default:
+      return MoveNone;
+      break;
+   }
+
+   // to square
+
+   s[0] = string[4];
+   s[1] = string[5];
+   s[2] = '\0';
+
+   to = square_from_string(s);
+   if (to == SquareNone) return MoveNone;
+
+   capture = board->square[to];
+   if (capture != Empty && !colour_equal(capture,colour_opp(colour))) return MoveNone;
+
+   // moved piece
+
+   if (string[0] == '?') {
+      piece = piece_make_pawn(colour);
+   } else {
+      piece = piece_from_char(string[0]);
+      piece = (piece_is_pawn(piece)) ? piece_make_pawn(colour) : piece_type(piece) | colour;
+   }
+
+   if ((promote != 0) != (piece_is_pawn(piece) && square_is_promote(to))) return MoveNone;
+
+   inc = (colour_is_white(colour)) ? +16 : -16;
+
+   // find the from square(s), walking back from the to square
+
+   from = SquareNone;
+   n = 0;
+
+   if (string[0] == '?' && string[1] == '?') { // pawn non-capture
+
+      if (capture != Empty) return MoveNone;
+
+      from = to - inc;
+      if (board->square[from] == Empty && square_side_rank(to,colour) == Rank4) {
+         from -= inc;
+      }
+
+      if (board->square[from] != piece) return MoveNone;
+      if (is_pinned(board,from,to,colour)) return MoveNone;
+
+      n = 1;
+
+   } else if (piece_is_pawn(piece)) {
+
+      if (capture == Empty && to != board->ep_square) return MoveNone;
+
+      for (sq = to-inc-1; sq <= to-inc+1; sq += 2) {
+         if (board->square[sq] == piece && from_is_ok(string,board,sq,to)) {
+            from = sq;
+            n++;
+         }
+      }
+
+   } else if (piece_is_king(piece)) {
+
+      sq = king_pos(board,colour);
+
+      if (piece_attack(board,piece,sq,to) && from_is_ok(string,board,sq,to)) {
+         from = sq;
+         n++;
+      }
+
+   } else {
+
+      switch (piece_type(piece)) {
+      case Knight64:
+         ptr_inc = KnightInc;
+         break;
+      case Bishop64:
+         ptr_inc = BishopInc;
+         break;
+      case Rook64:
+         ptr_inc = RookInc;
+         break;
+      default:
+         ptr_inc = QueenInc;
+         break;
+      }
+
+      for (; (inc=*ptr_inc) != IncNone; ptr_inc++) {
+
+         sq = to + inc;
+
+         if (piece_is_slider(piece)) {
+            while (board->square[sq] == Empty) sq += inc;
+         }
+
+         if (board->square[sq] == piece && from_is_ok(string,board,sq,to)) {
+            from = sq;
+            n++;
+         }
+      }
+   }
+
+   if (n != 1) return MoveNone;
+
+   move = move_make(from,to) | promote;
+
+   // unpinned moves are legal, except king moves, en-passant captures and evasions
+
+   if (piece_is_king(piece)
+    || (piece_is_pawn(piece) && to == board->ep_square)
+    || is_in_check(board,colour)) {
+      if (!pseudo_is_legal(move,board)) return MoveNone;
+   }
+
+   return move;
+}
+
+// from_is_ok()
+
+static bool from_is_ok(const char string[], const board_t * board, int from, int to) {
+
+   ASSERT(string!=NULL);
+   ASSERT(board_is_ok(board));
+   ASSERT(square_is_ok(from));
+   ASSERT(square_is_ok(to));
+
+   // from-square file or rank given in the SAN string, and no pin
+
+   if (string[1] != '?' && file_to_char(square_file(from)) != string[1]) return false;
+   if (string[2] != '?' && rank_to_char(square_rank(from)) != string[2]) return false;
+
+   return !is_pinned(board,from,to,board->turn);
+}
+
 // ambiguity()
 
 static int ambiguity(int move, const board_t * board) {
@@ -13,6 +13,7 @@
 
 extern bool move_to_san         (int move, const board_t * board, char string[], int size);
 extern int  move_from_san       (const char string[], const board_t * board);
+extern int  move_from_san_legal (const char string[], const board_t * board);
 
 extern int  move_from_san_debug (const char string[], const board_t * board);
 
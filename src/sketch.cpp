@@ -0,0 +1,122 @@
+
+// sketch.cpp
+
+// count-min sketch of (position,move) pairs for the make-book pre-pass:
+// SketchDepth rows of saturating 8-bit counters, the estimate is the
+// smallest counter, which is never below the real count
+
+// includes
+
+#include <cstring>
+
+#include "sketch.h"
+#include "util.h"
+
+// constants
+
+static const uint64 RowHash[SketchDepth] = {
+   U64(0x9E3779B97F4A7C15),
+   U64(0xC2B2AE3D27D4EB4F),
+   U64(0x165667B19E3779F9),
+   U64(0xD6E8FEB86659FD93),
+};
+
+// prototypes
+
+static uint32 slot (const sketch_t * sketch, int row, uint64 key, int move);
+
+// functions
+
+// sketch_init()
+
+void sketch_init(sketch_t * sketch, int mb) {
+
+   ASSERT(sketch!=NULL);
+   ASSERT(mb>=1);
+
+   // largest power of two per row that fits the budget
+
+   sketch->bits = 10;
+   while (sketch->bits < 28 && double(SketchDepth) * double(uint32(1) << (sketch->bits+1)) <= double(mb) * 1048576.0) {
+      sketch->bits++;
+   }
+
+   sketch->width = uint32(1) << sketch->bits;
+
+   sketch->counter = (uint8 *) my_malloc(SketchDepth*sketch->width);
+   memset(sketch->counter,0,SketchDepth*sketch->width);
+}
+
+// sketch_free()
+
+void sketch_free(sketch_t * sketch) {
+
+   ASSERT(sketch!=NULL);
+
+   my_free(sketch->counter);
+
+   sketch->counter = NULL;
+   sketch->bits = 0;
+   sketch->width = 0;
+}
+
+// sketch_add()
+
+void sketch_add(sketch_t * sketch, uint64 key, int move) {
+
+   int row;
+   uint8 * counter;
+   uint8 old;
+
+   ASSERT(sketch!=NULL);
+   ASSERT(sketch->counter!=NULL);
+
+   for (row = 0; row < SketchDepth; row++) {
+
+      counter = &sketch->counter[slot(sketch,row,key,move)];
+
+      // several make-book threads can share the sketch
+
+      do {
+         old = *counter;
+         if (old == SketchCountMax) break;
+      } while (__sync_val_compare_and_swap(counter,old,uint8(old+1)) != old);
+   }
+}
+
+// sketch_count()
+
+int sketch_count(const sketch_t * sketch, uint64 key, int move) {
+
+   int row;
+   int count, min;
+
+   ASSERT(sketch!=NULL);
+   ASSERT(sketch->counter!=NULL);
+
+   min = SketchCountMax;
+
+   for (row = 0; row < SketchDepth; row++) {
+      count = sketch->counter[slot(sketch,row,key,move)];
+      if (count < min) min = count;
+   }
+
+   return min;
+}
+
+// slot()
+
+static uint32 slot(const sketch_t * sketch, int row, uint64 key, int move) {
+
+   uint64 hash;
+
+   ASSERT(sketch!=NULL);
+   ASSERT(row>=0&&row<SketchDepth);
+
+   hash = (key ^ (uint64(move) << 48) ^ uint64(move)) * RowHash[row];
+
+   return uint32(row) * sketch->width + uint32(hash >> (64 - sketch->bits));
+}
+
+// end of sketch.cpp
+
@@ -0,0 +1,35 @@
+
+// sketch.h
+
+#ifndef SKETCH_H
+#define SKETCH_H
+
+// includes
+
+#include "util.h"
+
+// constants
+
+const int SketchDepth = 4;
+const int SketchCountMax = 255; // counters saturate
+
+// types
+
+struct sketch_t {
+   int bits;
+   uint32 width;
+   uint8 * counter;
+};
+
+// functions
+
+extern void sketch_init  (sketch_t * sketch, int mb);
+extern void sketch_free  (sketch_t * sketch);
+
+extern void sketch_add   (sketch_t * sketch, uint64 key, int move);
+extern int  sketch_count (const sketch_t * sketch, uint64 key, int move);
+
+#endif // !defined SKETCH_H
+
+// end of sketch.h
+